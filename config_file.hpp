@@ -96,14 +96,23 @@ class ConfigFile
          return false;
       }
 
+      // Numbers are formatted with nall rather than snprintf().
+      // Doubles are written with the fewest digits that read back exactly.
       void set(const string& key, int val)
       {
-         if (conf) config_set_int(conf, key, val);
+         char buf[32];
+         if (val < 0)
+            format_integer(buf, val);
+         else
+            format_decimal(buf, val);
+         if (conf) config_set_string(conf, key, buf);
       }
 
       void set(const string& key, double val)
       {
-         if (conf) config_set_double(conf, key, val);
+         char buf[32];
+         format_fp(buf, val);
+         if (conf) config_set_string(conf, key, buf);
       }
 
       void set(const string& key, const string& val)
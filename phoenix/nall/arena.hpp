@@ -0,0 +1,134 @@
+#ifndef NALL_ARENA_HPP
+#define NALL_ARENA_HPP
+
+#include <stdlib.h>
+#include <string.h>
+#include <nall/stdint.hpp>
+
+namespace nall {
+  //arena
+  //memory: O(bytes allocated since the last reset)
+  //
+  //arena hands out memory by bumping a pointer through large blocks. individual
+  //allocations are never freed; reset() releases all of them at once in O(1) (plus
+  //one free per extra block). it suits the objects of one parse or one UI rebuild,
+  //which are created together and all die together.
+  //
+  //the newest allocation can still be grown or given back in place, so a single
+  //container filled within an arena reallocates without copying.
+
+  struct arena {
+    enum : unsigned { BlockSize = 64 * 1024, Alignment = 16 };
+
+    void* allocate(unsigned size) {
+      size = (size + Alignment - 1) & ~(Alignment - 1);
+      allocations++;
+      if(!head || head->used + size > head->size) {
+        //large allocations get a block of their own, behind the one being filled
+        if(head && size > BlockSize / 4) return create(size, size, head->next)->data();
+        create(size > BlockSize ? size : BlockSize, 0, head);
+      }
+      void *data = head->data() + head->used;
+      head->used += size;
+      return data;
+    }
+
+    void* reallocate(void *data, unsigned size, unsigned newsize) {
+      if(!data) return allocate(newsize);
+      if(newsize <= size) return data;
+      if(newest(data, size)) {
+        unsigned used = (uint8_t*)data - head->data();
+        unsigned rounded = (newsize + Alignment - 1) & ~(Alignment - 1);
+        if(used + rounded <= head->size) {
+          head->used = used + rounded;
+          allocations++;
+          return data;
+        }
+      }
+      void *copy = allocate(newsize);
+      memcpy(copy, data, size);
+      release(data, size);
+      return copy;
+    }
+
+    //only the newest allocation can actually be given back
+    void release(void *data, unsigned size) {
+      if(data && newest(data, size)) head->used = (uint8_t*)data - head->data();
+    }
+
+    //copies length bytes plus a terminating null
+    char* duplicate(const char *source, unsigned length) {
+      char *data = (char*)allocate(length + 1);
+      memcpy(data, source, length);
+      data[length] = 0;
+      return data;
+    }
+
+    //frees everything; the first block is kept for the next pass
+    void reset() {
+      if(!head) return;
+      while(block *next = head->next) {
+        free(head);
+        head = next;
+      }
+      head->used = 0;
+    }
+
+    //instrumentation: requests served, and calls to malloc made to serve them
+    uint64_t allocations;
+    uint64_t blocks;
+
+    arena() : allocations(0), blocks(0), head(0) {
+    }
+
+    ~arena() {
+      while(head) {
+        block *next = head->next;
+        free(head);
+        head = next;
+      }
+    }
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+  protected:
+    struct block {
+      block *next;
+      unsigned size, used;
+      uint8_t* data() { return (uint8_t*)this + ((sizeof(block) + Alignment - 1) & ~(Alignment - 1)); }
+    };
+    block *head;
+
+    bool newest(void *data, unsigned size) const {
+      if(!head) return false;
+      unsigned rounded = (size + Alignment - 1) & ~(Alignment - 1);
+      return (uint8_t*)data + rounded == head->data() + head->used;
+    }
+
+    //links a new block in at link
+    block* create(unsigned capacity, unsigned used, block *&link) {
+      block *item = (block*)malloc(((sizeof(block) + Alignment - 1) & ~(Alignment - 1)) + capacity);
+      item->next = link;
+      item->size = capacity;
+      item->used = used;
+      link = item;
+      blocks++;
+      return item;
+    }
+  };
+
+  //lets linear_vector take its memory from an arena
+  struct arena_allocator {
+    void* allocate(unsigned size) { return source->allocate(size); }
+    void* reallocate(void *data, unsigned size, unsigned newsize) { return source->reallocate(data, size, newsize); }
+    void release(void *data, unsigned size) { source->release(data, size); }
+
+    arena_allocator(arena &source) : source(&source) {}
+
+  protected:
+    arena *source;
+  };
+}
+
+#endif
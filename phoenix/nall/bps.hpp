@@ -0,0 +1,146 @@
+#ifndef NALL_BPS_HPP
+#define NALL_BPS_HPP
+
+#include <string.h>
+#include <nall/crc32.hpp>
+#include <nall/stdint.hpp>
+
+namespace nall {
+
+//BPS patches: "BPS1", source, target and metadata sizes, metadata, then a stream of
+//commands building the target front to back, and the CRC32 of source, target and patch.
+//each command is a length and one of four actions: copy from the source at the same
+//offset, copy literal bytes from the patch, or copy from a relative position in the
+//source or in the target written so far. runs are copied in bulk, and the checksums
+//are computed over whole buffers afterwards.
+struct bps {
+  enum class result : unsigned {
+    unknown,
+    success,
+    patch_invalid,
+    source_invalid,
+    target_invalid,
+    target_too_small,
+    patch_checksum_invalid,
+    source_checksum_invalid,
+    target_checksum_invalid,
+  };
+
+  //targetlength is the capacity of targetdata on entry, and the size of the patched
+  //file on return. if it does not fit, target_too_small is returned before anything is
+  //written, so the required size can be queried by passing a null target.
+  result apply(
+    const uint8_t *patchdata, unsigned patchlength,
+    const uint8_t *sourcedata, unsigned sourcelength,
+    uint8_t *targetdata, unsigned &targetlength
+  ) {
+    patch_data = patchdata, patch_length = patchlength, patch_offset = 0;
+
+    if(patch_length < 19 || memcmp(patch_data, "BPS1", 4)) return result::patch_invalid;
+    patch_offset = 4;
+
+    uint64_t source_size = decode();
+    uint64_t target_size = decode();
+    uint64_t metadata_size = decode();
+    if(patch_offset + metadata_size > patch_length - 12) return result::patch_invalid;
+    patch_offset += metadata_size;
+
+    if(source_size != sourcelength) return result::source_invalid;
+    if(target_size > ~0u) return result::patch_invalid;
+    if(targetlength < target_size) {
+      targetlength = target_size;
+      return result::target_too_small;
+    }
+    targetlength = target_size;
+
+    unsigned end = patch_length - 12;
+    unsigned output = 0, source_relative = 0, target_relative = 0;
+    while(patch_offset < end) {
+      uint64_t data = decode();
+      uint64_t length = (data >> 2) + 1;
+      if(length > target_size - output) return result::target_invalid;
+
+      switch(data & 3) {
+        case 0: {  //source read
+          if(output + length > sourcelength) return result::source_invalid;
+          memcpy(targetdata + output, sourcedata + output, length);
+        } break;
+
+        case 1: {  //target read
+          if(patch_offset + length > end) return result::patch_invalid;
+          memcpy(targetdata + output, patch_data + patch_offset, length);
+          patch_offset += length;
+        } break;
+
+        case 2: {  //source copy
+          source_relative += relative();
+          if((uint64_t)source_relative + length > sourcelength) return result::source_invalid;
+          memcpy(targetdata + output, sourcedata + source_relative, length);
+          source_relative += length;
+        } break;
+
+        case 3: {  //target copy; may overlap what it writes, repeating a pattern
+          target_relative += relative();
+          if(target_relative >= output) return result::target_invalid;
+          uint8_t *to = targetdata + output;
+          const uint8_t *from = targetdata + target_relative;
+          if(output - target_relative >= length) {
+            memcpy(to, from, length);
+          } else {
+            for(unsigned n = 0; n < length; n++) to[n] = from[n];
+          }
+          target_relative += length;
+        } break;
+      }
+      output += length;
+    }
+
+    if(patch_offset != end || output != target_size) return result::patch_invalid;
+
+    uint32_t source_read_checksum = read32(end + 0);
+    uint32_t target_read_checksum = read32(end + 4);
+    uint32_t patch_read_checksum = read32(end + 8);
+
+    if(crc32_calculate(patch_data, patch_length - 4) != patch_read_checksum) return result::patch_checksum_invalid;
+    if(crc32_calculate(sourcedata, sourcelength) != source_read_checksum) return result::source_checksum_invalid;
+    if(crc32_calculate(targetdata, targetlength) != target_read_checksum) return result::target_checksum_invalid;
+    return result::success;
+  }
+
+private:
+  const uint8_t *patch_data;
+  unsigned patch_length;
+  unsigned patch_offset;
+
+  uint8_t patch_read() {
+    if(patch_offset < patch_length) return patch_data[patch_offset++];
+    return 0x00;
+  }
+
+  uint32_t read32(unsigned offset) {
+    return patch_data[offset] | patch_data[offset + 1] << 8 | patch_data[offset + 2] << 16 | (uint32_t)patch_data[offset + 3] << 24;
+  }
+
+  uint64_t decode() {
+    uint64_t offset = 0, shift = 1;
+    while(true) {
+      uint8_t x = patch_read();
+      offset += (x & 0x7f) * shift;
+      if(x & 0x80) break;
+      if(patch_offset >= patch_length) break;
+      shift <<= 7;
+      offset += shift;
+    }
+    return offset;
+  }
+
+  //signed offset: the lowest bit is the sign
+  unsigned relative() {
+    uint64_t data = decode();
+    return data & 1 ? -(unsigned)(data >> 1) : (unsigned)(data >> 1);
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef NALL_CHECKSUM_HPP
+#define NALL_CHECKSUM_HPP
+
+//checksums of files on disk, computed by streaming through file::stream()
+//so that peak memory stays constant even for multi-hundred-MB images
+
+#include <nall/crc32.hpp>
+#include <nall/file.hpp>
+#include <nall/sha256.hpp>
+#include <nall/string.hpp>
+
+namespace nall {
+  inline bool crc32_file(const string &filename, uint32_t &crc32, unsigned window = 1 << 20) {
+    uint32_t state = ~0;
+    bool result = file::stream(filename, [&](const uint8_t *data, unsigned size) {
+      state = crc32_update(state, data, size);
+    }, window);
+    if(result) crc32 = ~state;
+    return result;
+  }
+
+  inline bool sha256_file(const string &filename, uint8_t *hash, unsigned window = 1 << 20) {
+    sha256_ctx sha;
+    sha256_init(&sha);
+    bool result = file::stream(filename, [&](const uint8_t *data, unsigned size) {
+      sha256_chunk(&sha, data, size);
+    }, window);
+    if(!result) return false;
+    sha256_final(&sha);
+    sha256_hash(&sha, hash);
+    return true;
+  }
+
+  //computes both checksums in a single pass over the file
+  inline bool checksum_file(const string &filename, uint32_t &crc32, uint8_t *hash, unsigned window = 1 << 20) {
+    uint32_t state = ~0;
+    sha256_ctx sha;
+    sha256_init(&sha);
+    bool result = file::stream(filename, [&](const uint8_t *data, unsigned size) {
+      state = crc32_update(state, data, size);
+      sha256_chunk(&sha, data, size);
+    }, window);
+    if(!result) return false;
+    crc32 = ~state;
+    sha256_final(&sha);
+    sha256_hash(&sha, hash);
+    return true;
+  }
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef NALL_CPUID_HPP
+#define NALL_CPUID_HPP
+
+#include <nall/stdint.hpp>
+
+//runtime detection of x86 instruction set extensions.
+//code paths using these extensions are compiled with per-function target
+//attributes, so the rest of the program keeps the baseline instruction set.
+
+#if (defined(__i386__) || defined(__x86_64__)) && \
+  (defined(__clang__) || __GNUC__ >= 5 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+  #define NALL_CPUID_X86
+  #include <cpuid.h>
+  #include <immintrin.h>
+#endif
+
+namespace nall {
+  struct cpuid {
+    enum : unsigned {
+      sse2  = 1 << 0,
+      ssse3 = 1 << 1,
+      sse41 = 1 << 2,
+      avx2  = 1 << 3,
+      sha   = 1 << 4,
+    };
+
+    static bool supports(unsigned mask) {
+      static unsigned features = detect();
+      return (features & mask) == mask;
+    }
+
+  private:
+    static unsigned detect() {
+      unsigned features = 0;
+      #if defined(NALL_CPUID_X86)
+      unsigned eax, ebx, ecx, edx;
+      unsigned maximum = __get_cpuid_max(0, 0);
+      if(maximum < 1) return 0;
+
+      __cpuid(1, eax, ebx, ecx, edx);
+      if(edx & (1 << 26)) features |= sse2;
+      if(ecx & (1 <<  9)) features |= ssse3;
+      if(ecx & (1 << 19)) features |= sse41;
+
+      //AVX state must be enabled by the OS (OSXSAVE + XCR0 bits 1 and 2)
+      bool avx = false;
+      if((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+        unsigned xcr0, xcr0h;
+        __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" : "=a"(xcr0), "=d"(xcr0h) : "c"(0));
+        avx = (xcr0 & 6) == 6;
+      }
+
+      if(maximum >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if(avx && (ebx & (1 << 5))) features |= avx2;
+        if(ebx & (1 << 29)) features |= sha;
+      }
+      #endif
+      return features;
+    }
+  };
+}
+
+#endif
@@ -54,12 +54,46 @@ namespace nall {
     return ((crc32 >> 8) & 0x00ffffff) ^ crc32_table[(crc32 ^ input) & 0xff];
   }
 
-  inline uint32_t crc32_calculate(const uint8_t *data, unsigned length) {
-    uint32_t crc32 = ~0;
+  //slicing-by-8: table[n][i] advances the CRC of byte i by n further zero bytes,
+  //so that eight bytes can be folded in per step. built once, on first use.
+  struct crc32_slices {
+    uint32_t table[8][256];
+
+    crc32_slices() {
+      for(unsigned i = 0; i < 256; i++) table[0][i] = crc32_table[i];
+      for(unsigned n = 1; n < 8; n++) {
+        for(unsigned i = 0; i < 256; i++) {
+          uint32_t crc32 = table[n - 1][i];
+          table[n][i] = (crc32 >> 8) ^ crc32_table[crc32 & 0xff];
+        }
+      }
+    }
+  };
+
+  //incremental form: start from ~0, feed each chunk in order, and invert the final value
+  inline uint32_t crc32_update(uint32_t crc32, const uint8_t *data, unsigned length) {
+    if(length >= 16) {
+      static const crc32_slices slices;
+      const uint32_t (*t)[256] = slices.table;
+
+      while(length >= 8) {
+        uint32_t a = crc32 ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+        uint32_t b = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+        crc32 = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24]
+              ^ t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+        data += 8;
+        length -= 8;
+      }
+    }
+
     for(unsigned i = 0; i < length; i++) {
       crc32 = crc32_adjust(crc32, data[i]);
     }
-    return ~crc32;
+    return crc32;
+  }
+
+  inline uint32_t crc32_calculate(const uint8_t *data, unsigned length) {
+    return ~crc32_update(~0, data, length);
   }
 }
 
@@ -2,24 +2,59 @@
 #define NALL_DIRECTORY_HPP
 
 #include <nall/foreach.hpp>
+#include <nall/function.hpp>
 #include <nall/sort.hpp>
 #include <nall/string.hpp>
+#include <nall/thread.hpp>
+#include <nall/vector.hpp>
 
 #if defined(_WIN32)
   #include <nall/windows/utf8.hpp>
 #else
   #include <dirent.h>
+  #include <fcntl.h>
   #include <stdio.h>
+  #include <sys/stat.h>
   #include <sys/types.h>
+  #include <unistd.h>
+  #if defined(__linux__)
+    #include <sys/syscall.h>
+  #endif
 #endif
 
 namespace nall {
 
 struct directory {
+  struct entry {
+    enum class kind : unsigned { file, folder, link, other };
+    string name;     //walk() names are relative to the walked folder, without a trailing "/"
+    kind type;
+    uint64_t size;   //size and modify are zero unless details were requested
+    time_t modify;
+    uint64_t inode;  //zero on Windows
+  };
+
   static bool exists(const string &pathname);
   static lstring folders(const string &pathname, const string &pattern = "*");
   static lstring files(const string &pathname, const string &pattern = "*");
   static lstring contents(const string &pathname, const string &pattern = "*");
+
+  //calls callback for each entry of a folder as it is read, unsorted and unfiltered
+  static bool scan(const string &pathname, const function<void (entry&)> &callback, bool details = true);
+
+  //calls callback for every entry below a folder, with details, from one or more threads
+  //(0 = one per processor); calls are serialized, and entries of one folder arrive together.
+  //unchanged is asked about every folder found: returning true (e.g. because its modify
+  //time matches an earlier walk) skips reporting the files in it, which then need not be
+  //stat'ed. its subfolders are still visited, as their contents do not change the modify
+  //time of the parent; neither do rewrites of existing files.
+  static bool walk(const string &pathname, const function<void (const entry&)> &callback,
+    const function<bool (const entry&)> &unchanged = function<bool (const entry&)>(), unsigned threads = 1);
+
+protected:
+  struct walker;
+  template<typename Callback> static bool read(const string &pathname, const string &prefix, bool details, const Callback &callback);
+  static void list(const string &pathname, lstring *folders, const string &folderPattern, lstring *files, const string &filePattern);
 };
 
 #if defined(_WIN32)
@@ -29,68 +64,32 @@ struct directory {
     return (result & FILE_ATTRIBUTE_DIRECTORY);
   }
 
-  inline lstring directory::folders(const string &pathname, const string &pattern) {
-    lstring list;
-    string path = pathname;
-    path.transform("/", "\\");
-    if(!strend(path, "\\")) path.append("\\");
-    path.append("*");
-    HANDLE handle;
-    WIN32_FIND_DATA data;
-    handle = FindFirstFile(utf16_t(path), &data);
-    if(handle != INVALID_HANDLE_VALUE) {
-      if(wcscmp(data.cFileName, L".") && wcscmp(data.cFileName, L"..")) {
-        if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-          string name = (const char*)utf8_t(data.cFileName);
-          if(wildcard(name, pattern)) list.append(name);
-        }
-      }
-      while(FindNextFile(handle, &data) != false) {
-        if(wcscmp(data.cFileName, L".") && wcscmp(data.cFileName, L"..")) {
-          if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            string name = (const char*)utf8_t(data.cFileName);
-            if(wildcard(name, pattern)) list.append(name);
-          }
-        }
-      }
-      FindClose(handle);
-    }
-    if(list.size() > 0) sort(&list[0], list.size());
-    foreach(name, list) name.append("/");  //must append after sorting
-    return list;
-  }
-
-  inline lstring directory::files(const string &pathname, const string &pattern) {
-    lstring list;
+  //FindFirstFile returns sizes and times with each name, so details cost nothing here
+  template<typename Callback>
+  inline bool directory::read(const string &pathname, const string &prefix, bool details, const Callback &callback) {
     string path = pathname;
     path.transform("/", "\\");
     if(!strend(path, "\\")) path.append("\\");
     path.append("*");
-    HANDLE handle;
     WIN32_FIND_DATA data;
-    handle = FindFirstFile(utf16_t(path), &data);
-    if(handle != INVALID_HANDLE_VALUE) {
-      if((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
-        string name = (const char*)utf8_t(data.cFileName);
-        if(wildcard(name, pattern)) list.append(name);
-      }
-      while(FindNextFile(handle, &data) != false) {
-        if((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
-          string name = (const char*)utf8_t(data.cFileName);
-          if(wildcard(name, pattern)) list.append(name);
-        }
-      }
-      FindClose(handle);
-    }
-    if(list.size() > 0) sort(&list[0], list.size());
-    return list;
-  }
-
-  inline lstring directory::contents(const string &pathname, const string &pattern) {
-    lstring folders = directory::folders(pathname);  //pattern search of contents() should only filter files
-    lstring files = directory::files(pathname, pattern);
-    foreach(file, files) folders.append(file);
-    return folders;
+    HANDLE handle = FindFirstFile(utf16_t(path), &data);
+    if(handle == INVALID_HANDLE_VALUE) return false;
+    do {
+      if(!wcscmp(data.cFileName, L".") || !wcscmp(data.cFileName, L"..")) continue;
+      entry item;
+      item.name = {prefix, (const char*)utf8_t(data.cFileName)};
+      if(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) item.type = entry::kind::link;
+      else if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) item.type = entry::kind::folder;
+      else item.type = entry::kind::file;
+      item.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+      //FILETIME counts 100ns intervals since 1601-01-01
+      uint64_t time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+      item.modify = time ? time / 10000000 - 11644473600ull : 0;
+      item.inode = 0;
+      callback(item);
+    } while(FindNextFile(handle, &data) != false);
+    FindClose(handle);
+    return true;
   }
 #else
   inline bool directory::exists(const string &pathname) {
@@ -100,52 +99,295 @@ struct directory {
     return true;
   }
 
-  inline lstring directory::folders(const string &pathname, const string &pattern) {
-    lstring list;
-    DIR *dp;
-    struct dirent *ep;
-    dp = opendir(pathname);
-    if(dp) {
-      while(ep = readdir(dp)) {
-        if(!strcmp(ep->d_name, ".")) continue;
-        if(!strcmp(ep->d_name, "..")) continue;
-        if(ep->d_type & DT_DIR) {
-          if(wildcard(ep->d_name, pattern)) list.append(ep->d_name);
-        }
+  inline void directory_stat(int fd, const char *name, directory::entry &item) {
+    struct stat data;
+    if(fstatat(fd, name, &data, AT_SYMLINK_NOFOLLOW) != 0) return;
+    if(S_ISREG(data.st_mode)) item.type = directory::entry::kind::file;
+    else if(S_ISDIR(data.st_mode)) item.type = directory::entry::kind::folder;
+    else if(S_ISLNK(data.st_mode)) item.type = directory::entry::kind::link;
+    else item.type = directory::entry::kind::other;
+    item.size = data.st_size;
+    item.modify = data.st_mtime;
+    item.inode = data.st_ino;
+  }
+
+  //the entry type comes with each name from the kernel; only filesystems that do not
+  //report it (DT_UNKNOWN) need a stat call when no details were requested.
+  //stat calls are made relative to the open folder, so no path is resolved twice.
+  template<typename Callback>
+  inline void directory_entry(int fd, const char *name, unsigned char type, uint64_t inode, const string &prefix, bool details, const Callback &callback) {
+    if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) return;
+    directory::entry item;
+    item.name = {prefix, name};
+    item.type = type == DT_REG ? directory::entry::kind::file
+              : type == DT_DIR ? directory::entry::kind::folder
+              : type == DT_LNK ? directory::entry::kind::link
+              : directory::entry::kind::other;
+    item.size = 0;
+    item.modify = 0;
+    item.inode = inode;
+    if(details || type == DT_UNKNOWN) directory_stat(fd, name, item);
+    callback(item);
+  }
+
+  template<typename Callback>
+  inline bool directory_read(int base, const char *pathname, const string &prefix, bool details, const Callback &callback) {
+    int fd = openat(base, pathname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) return false;
+
+    #if defined(__linux__)
+    //getdents64 fills one large buffer per call, where readdir would make many small ones
+    struct linux_dirent64 {
+      uint64_t d_ino;
+      int64_t d_off;
+      unsigned short d_reclen;
+      unsigned char d_type;
+      char d_name[256];
+    };
+    uint64_t buffer[32768 / sizeof(uint64_t)];
+    while(true) {
+      long length = syscall(SYS_getdents64, fd, buffer, sizeof buffer);
+      if(length <= 0) break;
+      for(long offset = 0; offset < length;) {
+        const linux_dirent64 *ep = (const linux_dirent64*)((const char*)buffer + offset);
+        directory_entry(fd, ep->d_name, ep->d_type, ep->d_ino, prefix, details, callback);
+        offset += ep->d_reclen;
       }
-      closedir(dp);
     }
-    if(list.size() > 0) sort(&list[0], list.size());
+    close(fd);
+    #else
+    DIR *dp = fdopendir(fd);
+    if(!dp) {
+      close(fd);
+      return false;
+    }
+    while(struct dirent *ep = readdir(dp)) {
+      directory_entry(fd, ep->d_name, ep->d_type, ep->d_ino, prefix, details, callback);
+    }
+    closedir(dp);
+    #endif
+    return true;
+  }
+
+  template<typename Callback>
+  inline bool directory::read(const string &pathname, const string &prefix, bool details, const Callback &callback) {
+    return directory_read(AT_FDCWD, pathname, prefix, details, callback);
+  }
+#endif
+
+//one pass over the folder fills both lists; links count as folders when they lead to one
+inline void directory::list(const string &pathname, lstring *folders, const string &folderPattern, lstring *files, const string &filePattern) {
+  string path = pathname;
+  if(!strend(path, "/") && !strend(path, "\\")) path.append("/");
+  wildcard_pattern folderFilter(folderPattern), fileFilter(filePattern);  //prepared once for the whole listing
+
+  read(pathname, "", false, [&](entry &item) {
+    bool folder = item.type == entry::kind::folder;
+    if(item.type == entry::kind::link) folder = directory::exists({path, item.name});
+    if(folder) {
+      if(folders && folderFilter.match(item.name)) folders->append(std::move(item.name));
+    } else {
+      if(files && fileFilter.match(item.name)) files->append(std::move(item.name));
+    }
+  });
+
+  if(folders && folders->size() > 0) {
+    lstring &list = *folders;
+    parallel_sort(&list[0], list.size());
     foreach(name, list) name.append("/");  //must append after sorting
-    return list;
   }
+  if(files && files->size() > 0) {
+    lstring &list = *files;
+    parallel_sort(&list[0], list.size());
+  }
+}
+
+inline lstring directory::folders(const string &pathname, const string &pattern) {
+  lstring list;
+  directory::list(pathname, &list, pattern, 0, "");
+  return list;
+}
+
+inline lstring directory::files(const string &pathname, const string &pattern) {
+  lstring list;
+  directory::list(pathname, 0, "", &list, pattern);
+  return list;
+}
+
+inline lstring directory::contents(const string &pathname, const string &pattern) {
+  lstring folders, files;
+  directory::list(pathname, &folders, "*", &files, pattern);  //pattern search of contents() should only filter files
+  foreach(file, files) folders.append(std::move(file));
+  return folders;
+}
+
+inline bool directory::scan(const string &pathname, const function<void (entry&)> &callback, bool details) {
+  return read(pathname, "", details, callback);
+}
+
+//every worker owns a queue of folders still to be read. it takes the newest from its
+//own queue, so it goes depth first, and once that runs dry steals the oldest from
+//another worker, which tends to be the top of a large subtree nobody has entered yet.
+struct directory::walker {
+  struct task {
+    string folder;  //relative to the root, ending with "/" (empty for the root itself)
+    bool unchanged;
+  };
+
+  struct queue {
+    linear_vector<task> tasks;
+    unsigned head;
+    mutex lock;
+    queue() : head(0) {}
+  };
+
+  string root;
+  #if !defined(_WIN32)
+  int rootfd;
+  #endif
+  const function<void (const entry&)> *callback;
+  const function<bool (const entry&)> *unchanged;
+  queue *queues;
+  unsigned threads;
+  unsigned pending;  //folders queued or being read
+  mutex lock;        //guards pending, and serializes the callbacks
+  event signal;
+
+  void push(unsigned id, linear_vector<task> &tasks) {
+    if(tasks.size() == 0) return;
+    lock.lock();
+    pending += tasks.size();
+    lock.unlock();
+
+    queue &own = queues[id];
+    own.lock.lock();
+    foreach(item, tasks) own.tasks.append(std::move(item));
+    own.lock.unlock();
+    tasks.reset();
+    signal.signal();
+  }
+
+  bool pop(unsigned id, task &item) {
+    queue &own = queues[id];
+    own.lock.lock();
+    if(own.tasks.size() > own.head) {
+      item = std::move(own.tasks[own.tasks.size() - 1]);
+      own.tasks.resize(own.tasks.size() - 1);
+      if(own.tasks.size() == own.head) own.tasks.reset(), own.head = 0;
+      own.lock.unlock();
+      return true;
+    }
+    own.lock.unlock();
 
-  inline lstring directory::files(const string &pathname, const string &pattern) {
-    lstring list;
-    DIR *dp;
-    struct dirent *ep;
-    dp = opendir(pathname);
-    if(dp) {
-      while(ep = readdir(dp)) {
-        if(!strcmp(ep->d_name, ".")) continue;
-        if(!strcmp(ep->d_name, "..")) continue;
-        if((ep->d_type & DT_DIR) == 0) {
-          if(wildcard(ep->d_name, pattern)) list.append(ep->d_name);
+    for(unsigned n = 1; n < threads; n++) {
+      queue &other = queues[(id + n) % threads];
+      other.lock.lock();
+      if(other.tasks.size() > other.head) {
+        item = std::move(other.tasks[other.head++]);
+        bool more = other.tasks.size() > other.head;
+        if(!more) other.tasks.reset(), other.head = 0;
+        other.lock.unlock();
+        if(more) signal.signal();  //pass the wakeup on to another idle worker
+        return true;
+      }
+      other.lock.unlock();
+    }
+    return false;
+  }
+
+  template<typename Callback> bool read(const task &item, bool details, const Callback &callback) {
+    #if defined(_WIN32)
+    return directory::read({root, item.folder}, item.folder, details, callback);
+    #else
+    return directory_read(rootfd, item.folder.length() ? (const char*)item.folder : ".", item.folder, details, callback);
+    #endif
+  }
+
+  void worker(unsigned id) {
+    task item;
+    linear_vector<entry> list;
+    linear_vector<task> found;
+
+    while(true) {
+      if(pop(id, item) == false) {
+        lock.lock();
+        bool done = pending == 0;
+        lock.unlock();
+        if(done) {
+          signal.signal();  //wake the next idle worker, so it sees this too
+          return;
         }
+        signal.wait();
+        continue;
       }
-      closedir(dp);
+
+      //files of an unchanged folder are never reported, so they are not stat'ed either
+      read(item, !item.unchanged, [&](entry &child) {
+        if(item.unchanged && child.type != entry::kind::folder) return;
+        list.append(std::move(child));
+      });
+
+      lock.lock();
+      foreach(child, list) {
+        if(child.type == entry::kind::folder) {
+          #if !defined(_WIN32)
+          if(item.unchanged) directory_stat(rootfd, child.name, child);
+          #endif
+          (*callback)(child);
+          found.append({{child.name, "/"}, *unchanged && (*unchanged)(child)});
+        } else {
+          (*callback)(child);
+        }
+      }
+      lock.unlock();
+      list.reset();
+      push(id, found);
+
+      lock.lock();
+      bool done = --pending == 0;
+      lock.unlock();
+      if(done) signal.signal();
     }
-    if(list.size() > 0) sort(&list[0], list.size());
-    return list;
   }
+};
+
+inline bool directory::walk(const string &pathname, const function<void (const entry&)> &callback, const function<bool (const entry&)> &unchanged, unsigned threads) {
+  walker state;
+  state.root = pathname;
+  if(!strend(state.root, "/") && !strend(state.root, "\\")) state.root.append("/");
+  #if defined(_WIN32)
+  if(directory::exists(pathname) == false) return false;
+  #else
+  state.rootfd = open(pathname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(state.rootfd < 0) return false;
+  #endif
+
+  if(threads == 0) threads = thread::processors();
+  state.callback = &callback;
+  state.unchanged = &unchanged;
+  state.queues = new walker::queue[threads];
+  state.threads = threads;
+  state.pending = 0;
 
-  inline lstring directory::contents(const string &pathname, const string &pattern) {
-    lstring folders = directory::folders(pathname);  //pattern search of contents() should only filter files
-    lstring files = directory::files(pathname, pattern);
-    foreach(file, files) folders.append(file);
-    return folders;
+  linear_vector<walker::task> root;
+  root.append({"", false});
+  state.push(0, root);
+
+  if(threads == 1) {
+    state.worker(0);
+  } else {
+    thread *workers = new thread[threads];
+    for(unsigned n = 0; n < threads; n++) workers[n] = thread(&walker::worker, &state, n);
+    for(unsigned n = 0; n < threads; n++) workers[n].join();
+    delete[] workers;
   }
-#endif
+
+  delete[] state.queues;
+  #if !defined(_WIN32)
+  close(state.rootfd);
+  #endif
+  return true;
+}
 
 }
 
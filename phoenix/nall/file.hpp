@@ -7,6 +7,11 @@
 #include <nall/utility.hpp>
 #include <nall/windows/utf8.hpp>
 
+#include <fcntl.h>
+#if !defined(_WIN32)
+  #include <errno.h>
+#endif
+
 namespace nall {
   inline FILE* fopen_utf8(const string &utf8_filename, const char *mode) {
     #if !defined(_WIN32)
@@ -40,6 +45,88 @@ namespace nall {
       return true;
     }
 
+    //creates (or truncates) a file for writing through a raw descriptor,
+    //for writers that stream output instead of building it in memory
+    static int create(const string &filename) {
+      #if !defined(_WIN32)
+      return ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      #else
+      return _wopen(utf16_t(filename), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+      #endif
+    }
+
+    static bool write(int fd, const uint8_t *data, unsigned size) {
+      while(size) {
+        #if !defined(_WIN32)
+        ssize_t count = ::write(fd, data, size);
+        if(count < 0 && errno == EINTR) continue;
+        #else
+        int count = _write(fd, data, size);
+        #endif
+        if(count <= 0) return false;
+        data += count, size -= count;
+      }
+      return true;
+    }
+
+    //reserves disk space for a file about to be written, so that it is allocated in
+    //one piece up front rather than extended on every write. merely a hint.
+    static void preallocate(int fd, uint64_t size) {
+      #if defined(__linux__) && defined(_GNU_SOURCE)
+      if(size) fallocate(fd, 0, 0, size);
+      #endif
+    }
+
+    //reads a file front to back in fixed-size windows, invoking callback for each one.
+    //memory use is bounded by the window size regardless of file size; on POSIX systems
+    //the next window is read ahead and consumed pages are dropped from the page cache.
+    static bool stream(const string &filename, function<void (const uint8_t *data, unsigned size)> callback, unsigned window = 1 << 20) {
+      uint8_t *buffer = new uint8_t[window];
+      bool result = true;
+
+      #if !defined(_WIN32)
+      int fd = ::open(filename, O_RDONLY);
+      if(fd < 0) { delete[] buffer; return false; }
+      #if defined(POSIX_FADV_SEQUENTIAL)
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      #endif
+
+      off_t offset = 0;
+      while(true) {
+        #if defined(POSIX_FADV_WILLNEED)
+        posix_fadvise(fd, offset + window, window, POSIX_FADV_WILLNEED);
+        #endif
+
+        unsigned length = 0;
+        while(length < window) {
+          ssize_t count = ::read(fd, buffer + length, window - length);
+          if(count < 0 && errno == EINTR) continue;
+          if(count < 0) result = false;
+          if(count <= 0) break;
+          length += count;
+        }
+        if(length == 0) break;
+
+        callback(buffer, length);
+        #if defined(POSIX_FADV_DONTNEED)
+        posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+        #endif
+        offset += length;
+        if(length < window) break;
+      }
+      ::close(fd);
+      #else
+      FILE *fp = fopen_utf8(filename, "rb");
+      if(!fp) { delete[] buffer; return false; }
+      while(unsigned length = fread(buffer, 1, window, fp)) callback(buffer, length);
+      result = !ferror(fp);
+      fclose(fp);
+      #endif
+
+      delete[] buffer;
+      return result;
+    }
+
     uint8_t read() {
       if(!fp) return 0xff;                       //file not open
       if(file_mode == mode::write) return 0xff;  //reads not permitted
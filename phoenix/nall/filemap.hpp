@@ -24,7 +24,7 @@ namespace nall {
     bool open() const { return p_open(); }
     bool open(const char *filename, mode mode_) { return p_open(filename, mode_); }
     void close() { return p_close(); }
-    unsigned size() const { return p_size; }
+    uint64_t size() const { return p_size; }
     uint8_t* data() { return p_handle; }
     const uint8_t* data() const { return p_handle; }
     filemap() : p_size(0), p_handle(0) { p_ctor(); }
@@ -32,7 +32,7 @@ namespace nall {
     ~filemap() { p_dtor(); }
 
   private:
-    unsigned p_size;
+    uint64_t p_size;
     uint8_t *p_handle;
 
     #if defined(_WIN32)
@@ -82,9 +82,11 @@ namespace nall {
         creation_disposition, FILE_ATTRIBUTE_NORMAL, NULL);
       if(p_filehandle == INVALID_HANDLE_VALUE) return false;
 
-      p_size = GetFileSize(p_filehandle, NULL);
+      DWORD sizehigh = 0;
+      p_size = GetFileSize(p_filehandle, &sizehigh);
+      p_size |= (uint64_t)sizehigh << 32;
 
-      p_maphandle = CreateFileMapping(p_filehandle, NULL, flprotect, 0, p_size, NULL);
+      p_maphandle = CreateFileMapping(p_filehandle, NULL, flprotect, p_size >> 32, p_size, NULL);
       if(p_maphandle == INVALID_HANDLE_VALUE) {
         CloseHandle(p_filehandle);
         p_filehandle = INVALID_HANDLE_VALUE;
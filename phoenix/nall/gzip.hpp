@@ -1,7 +1,9 @@
 #ifndef NALL_GZIP_HPP
 #define NALL_GZIP_HPP
 
+#include <nall/crc32.hpp>
 #include <nall/file.hpp>
+#include <nall/filemap.hpp>
 #include <nall/inflate.hpp>
 
 namespace nall {
@@ -13,6 +15,8 @@ struct gzip {
 
   bool decompress(const string &filename);
   bool decompress(const uint8_t *data, unsigned size);
+  bool decompress(const string &filename, int fd);
+  bool header(const uint8_t *data, unsigned size, unsigned &p);
 
   gzip();
   ~gzip();
@@ -28,6 +32,56 @@ bool gzip::decompress(const string &filename) {
 }
 
 bool gzip::decompress(const uint8_t *data, unsigned size) {
+  unsigned p;
+  if(header(data, size, p) == false) return false;
+  unsigned isize = data[size - 4];
+  isize |= data[size - 3] << 8;
+  isize |= data[size - 2] << 16;
+  isize |= data[size - 1] << 24;
+
+  this->size = isize;
+  this->data = new uint8_t[this->size];
+  return inflate(this->data, this->size, data + p, size - p - 8);
+}
+
+//decompresses straight to a file descriptor through a fixed-size window,
+//verifying the CRC32 and size stored in the trailer
+bool gzip::decompress(const string &filename, int fd) {
+  filemap fm;
+  if(fm.open(filename, filemap::mode::read) == false) return false;
+  const uint8_t *data = fm.data();
+  unsigned size = fm.size();
+
+  unsigned p;
+  if(header(data, size, p) == false) return false;
+  uint32_t crc32 = data[size - 8] | (data[size - 7] << 8) | (data[size - 6] << 16) | (data[size - 5] << 24);
+  uint32_t isize = data[size - 4] | (data[size - 3] << 8) | (data[size - 2] << 16) | (data[size - 1] << 24);
+
+  inflate_stream *stream = new inflate_stream;
+  uint8_t *window = new uint8_t[1 << 16];
+  const uint8_t *in = data + p;
+  unsigned inlen = size - p - 8;
+  uint32_t crc = ~0, length = 0;
+  bool result = false;
+
+  while(true) {
+    uint8_t *out = window;
+    unsigned outlen = 1 << 16;
+    inflate_stream::status status = stream->run(in, inlen, out, outlen);
+    crc = crc32_update(crc, window, out - window);
+    length += out - window;
+    if(file::write(fd, window, out - window) == false) break;
+    if(status == inflate_stream::status::output) continue;
+    result = status == inflate_stream::status::finished;
+    break;
+  }
+
+  delete[] window;
+  delete stream;
+  return result && ~crc == crc32 && length == isize;  //ISIZE is the size modulo 2^32
+}
+
+bool gzip::header(const uint8_t *data, unsigned size, unsigned &p) {
   if(size < 18) return false;
   if(data[0] != 0x1f) return false;
   if(data[1] != 0x8b) return false;
@@ -39,11 +93,7 @@ bool gzip::decompress(const uint8_t *data, unsigned size) {
   mtime |= data[7] << 24;
   unsigned xfl = data[8];
   unsigned os = data[9];
-  unsigned p = 10;
-  unsigned isize = data[size - 4];
-  isize |= data[size - 3] << 8;
-  isize |= data[size - 2] << 16;
-  isize |= data[size - 1] << 24;
+  p = 10;
   filename = "";
 
   if(flg & 0x04) {  //FEXTRA
@@ -70,9 +120,7 @@ bool gzip::decompress(const uint8_t *data, unsigned size) {
     p += 2;
   }
 
-  this->size = isize;
-  this->data = new uint8_t[this->size];
-  return inflate(this->data, this->size, data + p, size - p - 8);
+  return true;
 }
 
 gzip::gzip() : data(0) {
@@ -23,9 +23,12 @@ namespace nall {
 
 struct http {
   string hostname;
+  unsigned port;
   addrinfo *serverinfo;
   int serversocket;
   string header;
+  unsigned status;  //of the last response
+  bool keepalive;   //false once the server has closed, or will close, the connection
 
   unsigned total_length;
   unsigned total_read;
@@ -33,27 +36,64 @@ struct http {
   function<bool (unsigned, unsigned)> progress_cb;
   function<void (const char *, unsigned)> write_cb;
 
+  //requests a path and reads the response. the connection is kept open, so further
+  //downloads can reuse it while keepalive is set.
   inline bool download(const string &path) {
-    total_length = 0;
-    total_read = 0;
+    if(request(path) == false) return false;
+    return response();
+  }
 
-    send({
+  //sends a request without waiting for its response, so that several requests can be
+  //in flight on one connection at once (pipelining). responses arrive in request order
+  //and are read one at a time with response(). extra holds additional header lines.
+  inline bool request(const string &path, const string &extra = "") {
+    return send({
       "GET ", path, " HTTP/1.1\r\n"
       "Host: ", hostname, "\r\n"
-      "Connection: close\r\n"
-      "User-Agent: nall::http\r\n"
+      "User-Agent: nall::http\r\n",
+      extra,
       "\r\n"
     });
+  }
+
+  //reads the next response, passing its body to write_cb.
+  //returns true for a complete 200 (or 206 partial content) response.
+  inline bool response() {
+    total_length = 0;
+    total_read = 0;
+    status = 0;
 
     header = downloadHeader();
-    if(!header.iposition("200 OK"))
+    if(header.beginswith("HTTP/") == false) {
+      keepalive = false;
       return false;
+    }
+    if(const char *p = strchr(header, ' ')) status = decimal(p + 1);
+    keepalive = header.beginswith("HTTP/1.1") && !field("Connection").iequals("close");
+
+    //the body of an error response is still read, to keep the connection in step
+    bool success = status == 200 || status == 206;
+    return downloadContent(success) && success;
+  }
 
-    return downloadContent();
+  //value of a response header field, matched case-insensitively
+  inline string field(const char *name) const {
+    string key = {"\r\n", name, ":"};
+    optional<unsigned> position = header.iposition(key);
+    if(!position) return "";
+
+    const char *value = (const char*)header + position() + key.length();
+    while(*value == ' ' || *value == '\t') value++;
+    unsigned length = 0;
+    while(value[length] && value[length] != '\r') length++;
+    return substr(value, 0, length);
   }
 
   inline bool connect(string host, unsigned port = 80) {
     hostname = host;
+    this->port = port;
+    bufferpos = bufferlength = 0;
+    keepalive = true;
 
     addrinfo hints;
     memset(&hints, 0, sizeof(addrinfo));
@@ -77,6 +117,12 @@ struct http {
     return true;
   }
 
+  //opens a fresh connection to the same server, once keepalive has dropped
+  inline bool reconnect() {
+    disconnect();
+    return connect(hostname, port);
+  }
+
   inline bool send(const string &data) {
     return send((const char*)data, data.length());
   }
@@ -84,7 +130,7 @@ struct http {
   inline bool send(const char *data, unsigned size) {
     while(size) {
       int length = ::send(serversocket, data, size, 0);
-      if(length == -1) return false;
+      if(length == -1) return fail();  //the connection is gone; it cannot be reused
       data += length;
       size -= length;
     }
@@ -93,93 +139,96 @@ struct http {
 
   inline string downloadHeader() {
     string output;
-    do {
-      char buffer[2];
-      int length = recv(serversocket, buffer, 1, 0);
-      if(length <= 0) return output;
-      buffer[1] = 0;
-      output.append(buffer);
-    } while(output.endswith("\r\n\r\n") == false);
-    return output;
+    while(true) {
+      string line = downloadLine();
+      if(line == "") return output;
+      output.append(line);
+      if(line == "\r\n" && output.length() > 2) return output;
+    }
   }
 
   inline string downloadChunkLength() {
+    return downloadLine();
+  }
+
+  //reads one line, including its line ending, through the receive buffer
+  inline string downloadLine() {
     string output;
-    do {
-      char buffer[2];
-      int length = recv(serversocket, buffer, 1, 0);
-      if(length <= 0) return output;
-      buffer[1] = 0;
-      output.append(buffer);
-    } while(output.endswith("\r\n") == false);
+    while(bufferpos < bufferlength || fill()) {
+      char *start = buffer + bufferpos;
+      char *end = (char*)memchr(start, '\n', bufferlength - bufferpos);
+      unsigned length = end ? end - start + 1 : bufferlength - bufferpos;
+
+      //the buffer has one spare byte, so any line can be terminated in place
+      char next = start[length];
+      start[length] = 0;
+      output.append(start);
+      start[length] = next;
+
+      bufferpos += length;
+      if(end) break;
+    }
     return output;
   }
 
-  inline bool downloadContent() {
-
-    if(header.iposition("\r\nTransfer-Encoding: chunked\r\n")) {
+  inline bool downloadContent(bool deliver = true) {
+    if(field("Transfer-Encoding").iequals("chunked")) {
       while(true) {
-        unsigned length = hex(downloadChunkLength());
+        string line = downloadChunkLength();
+        if(line == "") return fail();
+        unsigned length = hex(line);
         if(length == 0) break;
-
-        while(length) {
-          char buffer[2048];
-          int packetlength = recv(serversocket, buffer, min(sizeof(buffer), length), 0);
-          if(packetlength <= 0) break;
-          total_read += packetlength;
-          length -= packetlength;
-
-          write_cb(buffer, packetlength);
-          if(progress_cb && !progress_cb(total_read, total_length))
-            return false;
-        }
-      }
-    } else if(auto position = header.iposition("\r\nContent-Length: ")) {
-      unsigned length = decimal((const char*)header + position() + 18);
-      total_length = length;
-      while(length) {
-        char buffer[2048];
-        int packetlength = recv(serversocket, buffer, min(sizeof(buffer), length), 0);
-        if(packetlength <= 0) break;
-        total_read += packetlength;
-        length -= packetlength;
-
-        write_cb(buffer, packetlength);
-        if(progress_cb && !progress_cb(total_read, total_length))
-          return false;
+        if(downloadBody(length, deliver) == false) return false;
+        if(downloadLine() != "\r\n") return fail();
       }
-
-      if(total_read < total_length)
-        return false;
-    } else {
+      //trailer fields end with an empty line
       while(true) {
-        char buffer[2048];
-        int packetlength = recv(serversocket, buffer, 2048, 0);
-        if(packetlength <= 0) break;
-        total_read += packetlength;
-
-        write_cb(buffer, packetlength);
-        if(progress_cb && !progress_cb(total_read, total_length))
-          return false;
+        string line = downloadLine();
+        if(line == "") return fail();
+        if(line == "\r\n") break;
       }
+    } else if(field("Content-Length") != "") {
+      total_length = decimal(field("Content-Length"));
+      if(downloadBody(total_length, deliver) == false) return false;
+    } else {
+      //without a length, the body ends when the server closes the connection
+      keepalive = false;
+      downloadBody(~0u, deliver);
     }
 
     return true;
   }
 
+  //reads length bytes of body; the receive buffer is handed to write_cb directly
+  inline bool downloadBody(unsigned length, bool deliver) {
+    while(length) {
+      if(bufferpos == bufferlength && fill() == false) return length == ~0u ? true : fail();
+
+      unsigned packetlength = min(bufferlength - bufferpos, length);
+      const char *data = buffer + bufferpos;
+      bufferpos += packetlength;
+      if(length != ~0u) length -= packetlength;
+      total_read += packetlength;
+      if(deliver == false) continue;
+
+      write_cb(data, packetlength);
+      if(progress_cb && !progress_cb(total_read, total_length)) return fail();
+    }
+    return true;
+  }
+
   inline void disconnect() {
+    if(serversocket == -1) return;
     close(serversocket);
     freeaddrinfo(serverinfo);
     serverinfo = 0;
     serversocket = -1;
+    bufferpos = bufferlength = 0;
   }
 
-  #ifdef _WIN32
-  inline int close(int sock) {
-    return closesocket(sock);
-  }
-
-  inline http() {
+  inline http() : port(80), serverinfo(0), serversocket(-1), status(0), keepalive(false),
+  total_length(0), total_read(0), bufferpos(0), bufferlength(0) {
+    #ifdef _WIN32
     int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if(sock == INVALID_SOCKET && WSAGetLastError() == WSANOTINITIALISED) {
       WSADATA wsaData;
@@ -190,6 +239,36 @@ struct http {
     } else {
       close(sock);
     }
+    #endif
+  }
+
+private:
+  char buffer[16384 + 1];
+  unsigned bufferpos;
+  unsigned bufferlength;
+
+  inline bool fill() {
+    int length = recv(serversocket, buffer, sizeof(buffer) - 1, 0);
+    if(length <= 0) {
+      keepalive = false;
+      return false;
+    }
+    bufferpos = 0;
+    bufferlength = length;
+    return true;
+  }
+
+  //a response cut short leaves the connection out of step; it cannot be reused
+  inline bool fail() {
+    keepalive = false;
+    return false;
+  }
+
+public:
+
+  #ifdef _WIN32
+  inline int close(int sock) {
+    return closesocket(sock);
   }
   #endif
 };
@@ -1,358 +1,828 @@
 #ifndef NALL_INFLATE_HPP
 #define NALL_INFLATE_HPP
 
-#include <setjmp.h>
+#include <string.h>
+#include <nall/algorithm.hpp>
+#include <nall/platform.hpp>
+#include <nall/stdint.hpp>
 
 namespace nall {
 
-namespace puff {
-  inline int puff(
-    unsigned char *dest, unsigned long *destlen,
-    unsigned char *source, unsigned long *sourcelen
-  );
-}
-
-inline bool inflate(
-  uint8_t *target, unsigned targetLength,
-  const uint8_t *source, unsigned sourceLength
-) {
-  unsigned long tl = targetLength, sl = sourceLength;
-  int result = puff::puff((unsigned char*)target, &tl, (unsigned char*)source, &sl);
-  return result == 0;
-}
-
-namespace puff {
+namespace deflate {
 
-//zlib/contrib/puff.c
-//version 2.1*
-//author: Mark Adler
-//license: zlib
-//ported by: byuu
+//table-driven DEFLATE (RFC 1951) decoder
+//replaces the bit-at-a-time puff decoder by Mark Adler, keeping its error codes:
+//   0 = success, 1 = output space exhausted, 2 = input exhausted, < 0 = invalid stream
+//
+//huffman codes are resolved through a primary lookup table indexed by the next
+//lenbits/distbits of input; longer codes continue into a second-level table.
+//bits are kept in a 64-bit buffer that is refilled a word at a time, which holds
+//enough bits for a complete length/distance pair after each refill.
 
-//* I have corrected a bug in fixed(), where it was accessing uninitialized
-//  memory: calling construct() with lencode prior to initializing lencode.count
-
-enum {
+enum : unsigned {
   MAXBITS   =  15,
   MAXLCODES = 286,
   MAXDCODES =  30,
   FIXLCODES = 288,
   MAXCODES  = MAXLCODES + MAXDCODES,
-};
 
-struct state {
-  unsigned char *out;
-  unsigned long outlen;
-  unsigned long outcnt;
-
-  unsigned char *in;
-  unsigned long inlen;
-  unsigned long incnt;
-  int bitbuf;
-  int bitcnt;
-
-  jmp_buf env;
+  LENBITS   =  10,
+  DISTBITS  =   8,
+  CODEBITS  =   7,
+  LENSIZE   = 1536,  //>= 1332: largest possible 10-bit-root table (zlib's "enough")
+  DISTSIZE  =  512,  //>= 400: largest possible 8-bit-root table
+  CODESIZE  = 1 << CODEBITS,
 };
 
-struct huffman {
-  short *count;
-  short *symbol;
+//table entry layout:
+//  bits  0- 3: code length (bits to consume)
+//  bits  4- 7: extra bits to read, or second-level table index width
+//  bits  8-10: entry type
+//  bits 16-31: literal value, length/distance base, or second-level table offset
+enum : uint32_t {
+  INVALID  = 0 << 8,
+  LITERAL  = 1 << 8,
+  BASE     = 2 << 8,
+  END      = 3 << 8,
+  SUBTABLE = 4 << 8,
+  TYPEMASK = 7 << 8,
 };
 
-inline int bits(state *s, int need) {
-  long val;
-
-  val = s->bitbuf;
-  while(s->bitcnt < need) {
-    if(s->incnt == s->inlen) longjmp(s->env, 1);
-    val |= (long)(s->in[s->incnt++]) << s->bitcnt;
-    s->bitcnt += 8;
-  }
-
-  s->bitbuf = (int)(val >> need);
-  s->bitcnt -= need;
-
-  return (int)(val & ((1L << need) - 1));
+inline uint32_t entry(uint32_t type, unsigned value, unsigned extra = 0) {
+  return type | (value << 16) | (extra << 4);
 }
 
-inline int stored(state *s) {
-  unsigned len;
-
-  s->bitbuf = 0;
-  s->bitcnt = 0;
-
-  if(s->incnt + 4 > s->inlen) return 2;
-  len  = s->in[s->incnt++];
-  len |= s->in[s->incnt++] << 8;
-  if(s->in[s->incnt++] != (~len & 0xff) ||
-     s->in[s->incnt++] != ((~len >> 8) & 0xff)
-  ) return 2;
-
-  if(s->incnt + len > s->inlen) return 2;
-  if(s->out != 0) {
-    if(s->outcnt + len > s->outlen) return 1;
-    while(len--) s->out[s->outcnt++] = s->in[s->incnt++];
-  } else {
-    s->outcnt += len;
-    s->incnt += len;
+struct alphabet {
+  uint32_t lencode[FIXLCODES];
+  uint32_t distcode[MAXDCODES];
+  uint32_t lengthcode[19];
+
+  alphabet() {
+    static const uint16_t lens[29] = {
+      3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const uint8_t lext[29] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const uint16_t dists[30] = {
+      1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+      8193, 12289, 16385, 24577
+    };
+    static const uint8_t dext[30] = {
+      0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+      7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+      12, 12, 13, 13
+    };
+
+    for(unsigned n = 0; n < 256; n++) lencode[n] = entry(LITERAL, n);
+    lencode[256] = entry(END, 0);
+    for(unsigned n = 0; n < 29; n++) lencode[257 + n] = entry(BASE, lens[n], lext[n]);
+    lencode[286] = lencode[287] = entry(INVALID, 0);
+    for(unsigned n = 0; n < 30; n++) distcode[n] = entry(BASE, dists[n], dext[n]);
+    for(unsigned n = 0; n < 19; n++) lengthcode[n] = entry(LITERAL, n);
   }
 
-  return 0;
-}
-
-inline int decode(state *s, huffman *h) {
-  int len, code, first, count, index, bitbuf, left;
-  short *next;
-
-  bitbuf = s->bitbuf;
-  left = s->bitcnt;
-  code = first = index = 0;
-  len = 1;
-  next = h->count + 1;
-  while(true) {
-    while(left--) {
-      code |= bitbuf & 1;
-      bitbuf >>= 1;
-      count = *next++;
-      if(code - count < first) {
-        s->bitbuf = bitbuf;
-        s->bitcnt = (s->bitcnt - len) & 7;
-        return h->symbol[index + (code - first)];
-      }
-      index += count;
-      first += count;
-      first <<= 1;
-      code <<= 1;
-      len++;
-    }
-    left = (MAXBITS + 1) - len;
-    if(left == 0) break;
-    if(s->incnt == s->inlen) longjmp(s->env, 1);
-    bitbuf = s->in[s->incnt++];
-    if(left > 8) left = 8;
+  static const alphabet& get() {
+    static alphabet instance;
+    return instance;
   }
+};
 
-  return -10;
+inline unsigned reverse(unsigned code, unsigned length) {
+  unsigned result = 0;
+  while(length--) { result = (result << 1) | (code & 1); code >>= 1; }
+  return result;
 }
 
-inline int construct(huffman *h, short *length, int n) {
-  int symbol, len, left;
-  short offs[MAXBITS + 1];
+//builds a lookup table from a list of code lengths.
+//returns 0 for a complete code, < 0 for an over-subscribed code, and > 0 for an
+//incomplete code, in which case the table is still built: unused entries are invalid.
+inline int construct(
+  uint32_t *table, unsigned capacity, unsigned primary,
+  const uint8_t *length, unsigned n, const uint32_t *info
+) {
+  unsigned count[MAXBITS + 1] = {0};
+  unsigned offs[MAXBITS + 1], next[MAXBITS + 1];
+  uint16_t symbol[FIXLCODES];
 
-  for(len = 0; len <= MAXBITS; len++) h->count[len] = 0;
-  for(symbol = 0; symbol < n; symbol++) h->count[length[symbol]]++;
-  if(h->count[0] == n) return 0;
+  for(unsigned s = 0; s < n; s++) count[length[s]]++;
+  memset(table, 0, (1 << primary) * sizeof(uint32_t));
+  if(count[0] == n) return 0;
 
-  left = 1;
-  for(len = 1; len <= MAXBITS; len++) {
+  int left = 1;
+  for(unsigned len = 1; len <= MAXBITS; len++) {
     left <<= 1;
-    left -= h->count[len];
+    left -= count[len];
     if(left < 0) return left;
   }
 
+  //sort symbols by length, then by value: this is the canonical code order
   offs[1] = 0;
-  for(len = 1; len < MAXBITS; len++) offs[len + 1] = offs[len] + h->count[len];
-
-  for(symbol = 0; symbol < n; symbol++) {
-    if(length[symbol] != 0) h->symbol[offs[length[symbol]]++] = symbol;
+  next[1] = 0;
+  for(unsigned len = 1; len < MAXBITS; len++) {
+    offs[len + 1] = offs[len] + count[len];
+    next[len + 1] = (next[len] + count[len]) << 1;
+  }
+  for(unsigned s = 0; s < n; s++) {
+    if(length[s]) symbol[offs[length[s]]++] = s;
   }
 
-  return left;
-}
+  unsigned codes = n - count[0];
+  unsigned used = 1 << primary;
+  unsigned prefix = ~0u, offset = 0, subbits = 0;
 
-inline int codes(state *s, huffman *lencode, huffman *distcode) {
-  int symbol, len;
-  unsigned dist;
-  static const short lens[29] = {
-    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
-  };
-  static const short lext[29] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
-  };
-  static const short dists[30] = {
-    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
-    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-    8193, 12289, 16385, 24577
-  };
-  static const short dext[30] = {
-    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
-    7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-    12, 12, 13, 13
-  };
+  for(unsigned i = 0; i < codes; i++) {
+    unsigned s = symbol[i], len = length[s], code = next[len]++;
 
-  do {
-    symbol = decode(s, lencode);
-    if(symbol < 0) return symbol;
-    if(symbol < 256) {
-      if(s->out != 0) {
-        if(s->outcnt == s->outlen) return 1;
-        s->out[s->outcnt] = symbol;
+    if(len <= primary) {
+      for(unsigned r = reverse(code, len); r < (1u << primary); r += 1 << len) {
+        table[r] = info[s] | len;
       }
-      s->outcnt++;
-    } else if(symbol > 256) {
-      symbol -= 257;
-      if(symbol >= 29) return -10;
-      len = lens[symbol] + bits(s, lext[symbol]);
-
-      symbol = decode(s, distcode);
-      if(symbol < 0) return symbol;
-      dist = dists[symbol] + bits(s, dext[symbol]);
-#ifndef INFLATE_ALLOW_INVALID_DISTANCE_TOO_FAR
-      if(dist > s->outcnt) return -11;
-#endif
+      continue;
+    }
 
-      if(s->out != 0) {
-        if(s->outcnt + len > s->outlen) return 1;
-        while(len--) {
-          s->out[s->outcnt] =
-#ifdef INFLATE_ALLOW_INVALID_DISTANCE_TOO_FAR
-          dist > s->outcnt ? 0 :
-#endif
-          s->out[s->outcnt - dist];
-          s->outcnt++;
-        }
-      } else {
-        s->outcnt += len;
+    //codes sharing their first 'primary' bits are contiguous in canonical order;
+    //the last one of a run is the longest, and sizes the second-level table
+    unsigned key = code >> (len - primary);
+    if(key != prefix) {
+      prefix = key;
+      unsigned lastlen = len;
+      unsigned scan[MAXBITS + 1];
+      memcpy(scan, next, sizeof scan);
+      for(unsigned j = i + 1; j < codes; j++) {
+        unsigned l = length[symbol[j]], c = scan[l]++;
+        if((c >> (l - primary)) != key) break;
+        lastlen = l;
       }
+      subbits = lastlen - primary;
+      offset = used;
+      used += 1 << subbits;
+      if(used > capacity) return -1;
+      memset(table + offset, 0, (1 << subbits) * sizeof(uint32_t));
+      table[reverse(key, primary)] = entry(SUBTABLE, offset, subbits) | primary;
     }
-  } while(symbol != 256);
 
-  return 0;
-}
-
-inline int fixed(state *s) {
-  static int virgin = 1;
-  static short lencnt[MAXBITS + 1], lensym[FIXLCODES];
-  static short distcnt[MAXBITS + 1], distsym[MAXDCODES];
-  static huffman lencode, distcode;
+    unsigned remain = len - primary;
+    unsigned r = reverse(code & ((1 << remain) - 1), remain);
+    for(; r < (1u << subbits); r += 1 << remain) {
+      table[offset + r] = info[s] | remain;
+    }
+  }
 
-  if(virgin) {
-    int symbol = 0;
-    short lengths[FIXLCODES];
+  return left;
+}
 
-    lencode.count = lencnt;
-    lencode.symbol = lensym;
-    distcode.count = distcnt;
-    distcode.symbol = distsym;
+//tables for the fixed codes of block type 1, built on first use
+struct fixed_tables {
+  uint32_t lencode[LENSIZE];
+  uint32_t distcode[DISTSIZE];
 
+  fixed_tables() {
+    const alphabet &a = alphabet::get();
+    uint8_t lengths[FIXLCODES];
+    unsigned symbol = 0;
     for(; symbol <       144; symbol++) lengths[symbol] = 8;
     for(; symbol <       256; symbol++) lengths[symbol] = 9;
     for(; symbol <       280; symbol++) lengths[symbol] = 7;
     for(; symbol < FIXLCODES; symbol++) lengths[symbol] = 8;
-    construct(&lencode, lengths, FIXLCODES);
+    construct(lencode, LENSIZE, LENBITS, lengths, FIXLCODES, a.lencode);
 
     for(symbol = 0; symbol < MAXDCODES; symbol++) lengths[symbol] = 5;
-    construct(&distcode, lengths, MAXDCODES);
-
-    virgin = 0;
+    construct(distcode, DISTSIZE, DISTBITS, lengths, MAXDCODES, a.distcode);
   }
 
-  return codes(s, &lencode, &distcode);
-}
+  static const fixed_tables& get() {
+    static fixed_tables instance;
+    return instance;
+  }
+};
 
-inline int dynamic(state *s) {
-  int nlen, ndist, ncode, index, err;
-  short lengths[MAXCODES];
-  short lencnt[MAXBITS + 1], lensym[MAXLCODES];
-  short distcnt[MAXBITS + 1], distsym[MAXDCODES];
-  huffman lencode, distcode;
-  static const short order[19] = {
+//order in which code length code lengths are transmitted
+inline const uint8_t* lengthorder() {
+  static const uint8_t order[19] = {
     16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
   };
+  return order;
+}
+
+inline bool single(const uint8_t *lengths, unsigned n) {
+  for(unsigned s = 0; s < n; s++) if(lengths[s] > 1) return false;
+  return true;
+}
+
+struct decoder {
+  uint8_t *out;
+  unsigned outlen;
+  unsigned outcnt;
+
+  const uint8_t *in;
+  unsigned inlen;
+  unsigned incnt;  //may run past inlen by the zero padding read at end of input
+  uint64_t bitbuf;
+  unsigned bitcnt;
+
+  decoder(uint8_t *out, unsigned outlen, const uint8_t *in, unsigned inlen)
+  : out(out), outlen(outlen), outcnt(0), in(in), inlen(inlen), incnt(0), bitbuf(0), bitcnt(0) {}
+
+  //tops the bit buffer up to at least 56 bits.
+  //bits above bitcnt may already hold the next input bytes; reloading them is harmless.
+  alwaysinline void refill() {
+    if(incnt + 8 <= inlen) {
+      uint64_t word = 0;
+      for(unsigned n = 0; n < 8; n++) word |= (uint64_t)in[incnt + n] << (n << 3);
+      bitbuf |= word << bitcnt;
+      incnt += (63 - bitcnt) >> 3;
+      bitcnt |= 56;
+      return;
+    }
+    while(bitcnt < 56) {
+      if(incnt < inlen) bitbuf |= (uint64_t)in[incnt] << bitcnt;
+      incnt++;
+      bitcnt += 8;
+    }
+  }
+
+  //true once bits beyond the end of input have been consumed
+  alwaysinline bool exhausted() const {
+    return incnt - (bitcnt >> 3) > inlen;
+  }
+
+  alwaysinline unsigned take(unsigned need) {
+    unsigned result = bitbuf & ((1ull << need) - 1);
+    bitbuf >>= need;
+    bitcnt -= need;
+    return result;
+  }
+
+  alwaysinline uint32_t decode(const uint32_t *table, unsigned primary) {
+    uint32_t e = table[bitbuf & ((1 << primary) - 1)];
+    if((e & TYPEMASK) == SUBTABLE) {
+      bitbuf >>= primary;
+      bitcnt -= primary;
+      e = table[(e >> 16) + (bitbuf & ((1 << ((e >> 4) & 15)) - 1))];
+    }
+    bitbuf >>= e & 15;
+    bitcnt -= e & 15;
+    return e;
+  }
 
-  lencode.count = lencnt;
-  lencode.symbol = lensym;
-  distcode.count = distcnt;
-  distcode.symbol = distsym;
-
-  nlen = bits(s, 5) + 257;
-  ndist = bits(s, 5) + 1;
-  ncode = bits(s, 4) + 4;
-  if(nlen > MAXLCODES || ndist > MAXDCODES) return -3;
-
-  for(index = 0; index < ncode; index++) lengths[order[index]] = bits(s, 3);
-  for(; index < 19; index++) lengths[order[index]] = 0;
-
-  err = construct(&lencode, lengths, 19);
-  if(err != 0) return -4;
-
-  index = 0;
-  while(index < nlen + ndist) {
-    int symbol, len;
-
-    symbol = decode(s, &lencode);
-    if(symbol < 16) {
-      lengths[index++] = symbol;
-    } else {
-      len = 0;
-      if(symbol == 16) {
-        if(index == 0) return -5;
-        len = lengths[index - 1];
-        symbol = 3 + bits(s, 2);
-      } else if(symbol == 17) {
-        symbol = 3 + bits(s, 3);
+  inline int stored() {
+    //discard the remaining bits of the current byte, then return whole
+    //buffered bytes to the input stream
+    take(bitcnt & 7);
+    incnt -= bitcnt >> 3;
+    bitbuf = 0;
+    bitcnt = 0;
+
+    if(incnt + 4 > inlen) return 2;
+    unsigned len = in[incnt + 0] | (in[incnt + 1] << 8);
+    if(in[incnt + 2] != (~len & 0xff) || in[incnt + 3] != ((~len >> 8) & 0xff)) return 2;
+    incnt += 4;
+
+    if(incnt + len > inlen) return 2;
+    if(outcnt + len > outlen) return 1;
+    memcpy(out + outcnt, in + incnt, len);
+    outcnt += len;
+    incnt += len;
+    return 0;
+  }
+
+  inline int codes(const uint32_t *lencode, const uint32_t *distcode) {
+    uint8_t *op = out + outcnt;
+    uint8_t *const end = out + outlen;
+
+    while(true) {
+      refill();
+      if(exhausted()) { outcnt = op - out; return 2; }
+
+      uint32_t e = decode(lencode, LENBITS);
+      if((e & TYPEMASK) == LITERAL) {
+        if(op == end) { outcnt = op - out; return 1; }
+        *op++ = e >> 16;
+        continue;
+      }
+      if((e & TYPEMASK) == END) break;
+      if((e & TYPEMASK) != BASE) { outcnt = op - out; return -10; }
+      unsigned len = (e >> 16) + take((e >> 4) & 15);
+
+      e = decode(distcode, DISTBITS);
+      if((e & TYPEMASK) != BASE) { outcnt = op - out; return -10; }
+      unsigned dist = (e >> 16) + take((e >> 4) & 15);
+
+      if(len > (unsigned)(end - op)) { outcnt = op - out; return 1; }
+      const uint8_t *from = op - dist;
+
+      if(dist > (unsigned)(op - out)) {
+        #ifndef INFLATE_ALLOW_INVALID_DISTANCE_TOO_FAR
+        outcnt = op - out;
+        return -11;
+        #else
+        while(len--) { *op = dist > (unsigned)(op - out) ? 0 : op[-(int)dist]; op++; }
+        continue;
+        #endif
+      }
+
+      if(dist >= 8 && len + 8 <= (unsigned)(end - op)) {
+        //8-byte chunks never read bytes that this copy has yet to write;
+        //the final chunk may spill up to 7 bytes past len into free space
+        uint8_t *stop = op + len;
+        do { memcpy(op, from, 8); op += 8; from += 8; } while(op < stop);
+        op = stop;
+      } else if(dist == 1) {
+        memset(op, op[-1], len);
+        op += len;
       } else {
-        symbol = 11 + bits(s, 7);
+        while(len--) *op++ = *from++;
       }
-      if(index + symbol > nlen + ndist) return -6;
-      while(symbol--) lengths[index++] = len;
     }
+
+    outcnt = op - out;
+    return 0;
   }
 
-  if(lengths[256] == 0) return -9;
+  inline int fixed() {
+    const fixed_tables &fixed = fixed_tables::get();
+    return codes(fixed.lencode, fixed.distcode);
+  }
 
-  err = construct(&lencode, lengths, nlen);
-  if(err < 0 || (err > 0 && nlen - lencode.count[0] != 1)) return -7;
+  inline int dynamic() {
+    const uint8_t *order = lengthorder();
+    const alphabet &a = alphabet::get();
+    uint8_t lengths[MAXCODES];
+    uint32_t lengthcode[CODESIZE];
+    uint32_t lencode[LENSIZE];
+    uint32_t distcode[DISTSIZE];
+
+    refill();
+    unsigned nlen = take(5) + 257;
+    unsigned ndist = take(5) + 1;
+    unsigned ncode = take(4) + 4;
+    if(nlen > MAXLCODES || ndist > MAXDCODES) return -3;
+
+    unsigned index;
+    for(index = 0; index < ncode; index++) {
+      if(bitcnt < 3) refill();
+      lengths[order[index]] = take(3);
+    }
+    for(; index < 19; index++) lengths[order[index]] = 0;
 
-  err = construct(&distcode, lengths + nlen, ndist);
-  if(err < 0 || (err > 0 && ndist - distcode.count[0] != 1)) return -8;
+    if(construct(lengthcode, CODESIZE, CODEBITS, lengths, 19, a.lengthcode) != 0) return -4;
 
-  return codes(s, &lencode, &distcode);
-}
+    index = 0;
+    while(index < nlen + ndist) {
+      refill();
+      if(exhausted()) return 2;
+
+      uint32_t e = decode(lengthcode, CODEBITS);
+      if((e & TYPEMASK) != LITERAL) return -10;
+      unsigned symbol = e >> 16;
+      if(symbol < 16) {
+        lengths[index++] = symbol;
+      } else {
+        unsigned len = 0;
+        if(symbol == 16) {
+          if(index == 0) return -5;
+          len = lengths[index - 1];
+          symbol = 3 + take(2);
+        } else if(symbol == 17) {
+          symbol = 3 + take(3);
+        } else {
+          symbol = 11 + take(7);
+        }
+        if(index + symbol > nlen + ndist) return -6;
+        memset(lengths + index, len, symbol);
+        index += symbol;
+      }
+    }
+
+    if(lengths[256] == 0) return -9;
+
+    //incomplete codes are only permitted when they consist of a single one-bit code
+    int err = construct(lencode, LENSIZE, LENBITS, lengths, nlen, a.lencode);
+    if(err < 0 || (err > 0 && !single(lengths, nlen))) return -7;
+    err = construct(distcode, DISTSIZE, DISTBITS, lengths + nlen, ndist, a.distcode);
+    if(err < 0 || (err > 0 && !single(lengths + nlen, ndist))) return -8;
+
+    return codes(lencode, distcode);
+  }
+
+  inline int run() {
+    unsigned last, type;
+    int err;
 
-inline int puff(
-  unsigned char *dest, unsigned long *destlen,
-  unsigned char *source, unsigned long *sourcelen
-) {
-  state s;
-  int last, type, err;
-
-  s.out = dest;
-  s.outlen = *destlen;
-  s.outcnt = 0;
-
-  s.in = source;
-  s.inlen = *sourcelen;
-  s.incnt = 0;
-  s.bitbuf = 0;
-  s.bitcnt = 0;
-
-  if(setjmp(s.env) != 0) {
-    err = 2;
-  } else {
     do {
-      last = bits(&s, 1);
-      type = bits(&s, 2);
-      err = type == 0 ? stored(&s)
-          : type == 1 ? fixed(&s)
-          : type == 2 ? dynamic(&s)
+      refill();
+      last = take(1);
+      type = take(2);
+      err = type == 0 ? stored()
+          : type == 1 ? fixed()
+          : type == 2 ? dynamic()
           : -1;
-      if(err != 0) break;
+      if(err != 0) return err;
     } while(!last);
+
+    return exhausted() ? 2 : 0;
+  }
+};
+
+//resumable decoder for streams that do not fit in memory at once.
+//input is accepted in chunks of any size and output is produced into caller-supplied
+//windows of any size; the last 32KB of output are kept as history for back-references.
+//run() advances in/out past the consumed input and produced output, and returns:
+//  input    = all input consumed, call again with more
+//  output   = output window full, call again with a fresh window
+//  finished = the final block has been decoded
+//  error    = invalid stream
+struct stream {
+  enum class status : unsigned { input, output, finished, error };
+
+  stream() {
+    reset();
+  }
+
+  void reset() {
+    mode = state::header;
+    last = false;
+    bitbuf = 0;
+    bitcnt = 0;
+    hpos = 0;
+    hsize = 0;
+    memset(history, 0, sizeof history);
+  }
+
+  status run(const uint8_t *&in, unsigned &inlen, uint8_t *&out, unsigned &outlen) {
+    ip = in, iend = in + inlen;
+    obase = op = out, oend = out + outlen;
+
+    status result = step();
+
+    //keep the last 32KB of output as history for the next call
+    unsigned produced = op - obase;
+    const uint8_t *p = produced > WINDOW ? op - WINDOW : obase;
+    while(p < op) {
+      unsigned length = min((unsigned)(op - p), WINDOW - hpos);
+      memcpy(history + hpos, p, length);
+      hpos = (hpos + length) & (WINDOW - 1);
+      p += length;
+    }
+    hsize = min(hsize + produced, WINDOW);
+
+    inlen -= ip - in, in = ip;
+    outlen -= op - out, out = op;
+    return result;
+  }
+
+private:
+  enum : unsigned { WINDOW = 32768 };
+  enum class state : unsigned { header, stored, copystored, table, codelengths, lengths, codes, copy, done, error };
+
+  state mode;
+  bool last;
+  uint64_t bitbuf;
+  unsigned bitcnt;
+
+  const uint8_t *ip, *iend;
+  uint8_t *obase, *op, *oend;
+
+  unsigned remain;    //bytes left in a stored block or match
+  unsigned distance;  //of the pending match
+  unsigned nlen, ndist, ncode, index;
+
+  const uint32_t *lentable;
+  const uint32_t *disttable;
+  uint8_t lengths[MAXCODES];
+  uint32_t lengthcode[CODESIZE];
+  uint32_t lencode[LENSIZE];
+  uint32_t distcode[DISTSIZE];
+
+  uint8_t history[WINDOW];
+  unsigned hpos;   //next write position
+  unsigned hsize;  //valid bytes
+
+  //unlike the one-shot decoder, bits past the end of the current input are never invented:
+  //bitcnt only counts bits actually read, and bits above it are cleared before a byte refill
+  alwaysinline void refill() {
+    if(iend - ip >= 8) {
+      uint64_t word = 0;
+      for(unsigned n = 0; n < 8; n++) word |= (uint64_t)ip[n] << (n << 3);
+      bitbuf |= word << bitcnt;
+      ip += (63 - bitcnt) >> 3;
+      bitcnt |= 56;
+      return;
+    }
+    if(bitcnt < 56) bitbuf &= (1ull << bitcnt) - 1;
+    while(bitcnt < 56 && ip < iend) {
+      bitbuf |= (uint64_t)*ip++ << bitcnt;
+      bitcnt += 8;
+    }
+  }
+
+  alwaysinline unsigned take(unsigned need) {
+    unsigned result = bitbuf & ((1ull << need) - 1);
+    bitbuf >>= need;
+    bitcnt -= need;
+    return result;
+  }
+
+  //decodes from a copy of the bit buffer, so that a sequence of codes can be
+  //abandoned as a whole when the input runs out partway through it
+  static alwaysinline bool fetch(const uint32_t *table, unsigned primary, uint64_t &buf, unsigned &cnt, uint32_t &e) {
+    unsigned used = 0, width = primary;
+    e = table[buf & ((1 << primary) - 1)];
+    if((e & TYPEMASK) == SUBTABLE) {
+      used = width = primary;
+      width += (e >> 4) & 15;
+      e = table[(e >> 16) + ((buf >> primary) & ((1 << ((e >> 4) & 15)) - 1))];
+    }
+    used += e & 15;
+    if(used > cnt || ((e & TYPEMASK) == INVALID && width > cnt)) return false;
+    buf >>= used;
+    cnt -= used;
+    return true;
+  }
+
+  static alwaysinline bool extra(unsigned need, uint64_t &buf, unsigned &cnt, unsigned &value) {
+    if(need > cnt) return false;
+    value += buf & ((1ull << need) - 1);
+    buf >>= need;
+    cnt -= need;
+    return true;
+  }
+
+  //copies the pending match, reaching into history for bytes produced by earlier calls
+  inline void copy() {
+    while(remain && op < oend) {
+      unsigned produced = op - obase;
+      unsigned length = min(remain, (unsigned)(oend - op));
+      if(distance > produced) {
+        unsigned back = distance - produced;
+        unsigned pos = (hpos - back) & (WINDOW - 1);
+        length = min(length, min(back, WINDOW - pos));
+        memcpy(op, history + pos, length);
+        op += length;
+      } else if(distance == 1) {
+        memset(op, op[-1], length);
+        op += length;
+      } else {
+        const uint8_t *from = op - distance;
+        for(unsigned n = 0; n < length; n++) *op++ = *from++;
+      }
+      remain -= length;
+    }
+  }
+
+  alwaysinline bool match(unsigned len, unsigned dist) {
+    #ifndef INFLATE_ALLOW_INVALID_DISTANCE_TOO_FAR
+    if(dist > hsize + (op - obase)) return false;
+    #endif
+    remain = len;
+    distance = dist;
+    mode = state::copy;
+    return true;
+  }
+
+  //decodes while enough input and output remain that no single code can run short
+  inline bool fast() {
+    while(iend - ip >= 8 && oend - op >= 258 + 8) {
+      refill();
+      uint32_t e = decode(lentable, LENBITS);
+      if((e & TYPEMASK) == LITERAL) {
+        *op++ = e >> 16;
+        continue;
+      }
+      if((e & TYPEMASK) == END) {
+        mode = last ? state::done : state::header;
+        return true;
+      }
+      if((e & TYPEMASK) != BASE) return false;
+      unsigned len = (e >> 16) + take((e >> 4) & 15);
+
+      e = decode(disttable, DISTBITS);
+      if((e & TYPEMASK) != BASE) return false;
+      unsigned dist = (e >> 16) + take((e >> 4) & 15);
+      if(dist > (unsigned)(op - obase)) {
+        //reaches into history; the window has room for the whole match
+        if(!match(len, dist)) return false;
+        copy();
+        mode = state::codes;
+        continue;
+      }
+
+      const uint8_t *from = op - dist;
+      if(dist >= 8) {
+        uint8_t *stop = op + len;
+        do { memcpy(op, from, 8); op += 8; from += 8; } while(op < stop);
+        op = stop;
+      } else if(dist == 1) {
+        memset(op, op[-1], len);
+        op += len;
+      } else {
+        while(len--) *op++ = *from++;
+      }
+    }
+    return true;
   }
 
-  if(err <= 0) {
-    *destlen = s.outcnt;
-    *sourcelen = s.incnt;
+  alwaysinline uint32_t decode(const uint32_t *table, unsigned primary) {
+    uint32_t e = table[bitbuf & ((1 << primary) - 1)];
+    if((e & TYPEMASK) == SUBTABLE) {
+      bitbuf >>= primary;
+      bitcnt -= primary;
+      e = table[(e >> 16) + (bitbuf & ((1 << ((e >> 4) & 15)) - 1))];
+    }
+    bitbuf >>= e & 15;
+    bitcnt -= e & 15;
+    return e;
   }
 
-  return err;
+  inline status step() {
+    const alphabet &a = alphabet::get();
+
+    while(true) switch(mode) {
+
+    case state::header: {
+      refill();
+      if(bitcnt < 3) return status::input;
+      last = take(1);
+      unsigned type = take(2);
+      if(type == 0) {
+        take(bitcnt & 7);
+        mode = state::stored;
+      } else if(type == 1) {
+        const fixed_tables &fixed = fixed_tables::get();
+        lentable = fixed.lencode;
+        disttable = fixed.distcode;
+        mode = state::codes;
+      } else if(type == 2) {
+        mode = state::table;
+      } else {
+        mode = state::error;
+      }
+      break;
+    }
+
+    case state::stored: {
+      refill();
+      if(bitcnt < 32) return status::input;
+      remain = take(16);
+      if(take(16) != (~remain & 0xffff)) { mode = state::error; break; }
+      mode = state::copystored;
+      break;
+    }
+
+    case state::copystored: {
+      //whole bytes still in the bit buffer come first, then the input itself
+      while(remain && bitcnt >= 8) {
+        if(op == oend) return status::output;
+        *op++ = take(8);
+        remain--;
+      }
+      if(bitcnt == 0) bitbuf = 0;
+      unsigned length = min(remain, min((unsigned)(iend - ip), (unsigned)(oend - op)));
+      memcpy(op, ip, length);
+      op += length, ip += length, remain -= length;
+      if(remain == 0) { mode = last ? state::done : state::header; break; }
+      if(op == oend) return status::output;
+      return status::input;
+    }
+
+    case state::table: {
+      refill();
+      if(bitcnt < 14) return status::input;
+      nlen = take(5) + 257;
+      ndist = take(5) + 1;
+      ncode = take(4) + 4;
+      if(nlen > MAXLCODES || ndist > MAXDCODES) { mode = state::error; break; }
+      index = 0;
+      mode = state::codelengths;
+      break;
+    }
+
+    case state::codelengths: {
+      const uint8_t *order = lengthorder();
+      while(index < ncode) {
+        if(bitcnt < 3) refill();
+        if(bitcnt < 3) return status::input;
+        lengths[order[index++]] = take(3);
+      }
+      for(; index < 19; index++) lengths[order[index]] = 0;
+      if(construct(lengthcode, CODESIZE, CODEBITS, lengths, 19, a.lengthcode) != 0) { mode = state::error; break; }
+      index = 0;
+      mode = state::lengths;
+      break;
+    }
+
+    case state::lengths: {
+      while(index < nlen + ndist) {
+        refill();
+        uint64_t buf = bitbuf;
+        unsigned cnt = bitcnt;
+        uint32_t e;
+        if(!fetch(lengthcode, CODEBITS, buf, cnt, e)) return status::input;
+        if((e & TYPEMASK) != LITERAL) { mode = state::error; break; }
+
+        unsigned symbol = e >> 16, len = 0, repeat = 0;
+        if(symbol < 16) {
+          lengths[index++] = symbol;
+          bitbuf = buf, bitcnt = cnt;
+          continue;
+        }
+        if(symbol == 16) {
+          if(index == 0) { mode = state::error; break; }
+          len = lengths[index - 1];
+          repeat = 3;
+          if(!extra(2, buf, cnt, repeat)) return status::input;
+        } else if(symbol == 17) {
+          repeat = 3;
+          if(!extra(3, buf, cnt, repeat)) return status::input;
+        } else {
+          repeat = 11;
+          if(!extra(7, buf, cnt, repeat)) return status::input;
+        }
+        if(index + repeat > nlen + ndist) { mode = state::error; break; }
+        memset(lengths + index, len, repeat);
+        index += repeat;
+        bitbuf = buf, bitcnt = cnt;
+      }
+      if(mode == state::error) break;
+      if(lengths[256] == 0) { mode = state::error; break; }
+
+      int err = construct(lencode, LENSIZE, LENBITS, lengths, nlen, a.lencode);
+      if(err < 0 || (err > 0 && !single(lengths, nlen))) { mode = state::error; break; }
+      err = construct(distcode, DISTSIZE, DISTBITS, lengths + nlen, ndist, a.distcode);
+      if(err < 0 || (err > 0 && !single(lengths + nlen, ndist))) { mode = state::error; break; }
+      lentable = lencode;
+      disttable = distcode;
+      mode = state::codes;
+      break;
+    }
+
+    case state::codes: {
+      if(!fast()) { mode = state::error; break; }
+      if(mode != state::codes) break;
+
+      //near the end of the input or output window, check every code for room
+      refill();
+      uint64_t buf = bitbuf;
+      unsigned cnt = bitcnt;
+      uint32_t e;
+      if(!fetch(lentable, LENBITS, buf, cnt, e)) return status::input;
+      if((e & TYPEMASK) == LITERAL) {
+        if(op == oend) return status::output;
+        *op++ = e >> 16;
+        bitbuf = buf, bitcnt = cnt;
+        break;
+      }
+      if((e & TYPEMASK) == END) {
+        mode = last ? state::done : state::header;
+        bitbuf = buf, bitcnt = cnt;
+        break;
+      }
+      if((e & TYPEMASK) != BASE) { mode = state::error; break; }
+      unsigned len = e >> 16;
+      if(!extra((e >> 4) & 15, buf, cnt, len)) return status::input;
+
+      if(!fetch(disttable, DISTBITS, buf, cnt, e)) return status::input;
+      if((e & TYPEMASK) != BASE) { mode = state::error; break; }
+      unsigned dist = e >> 16;
+      if(!extra((e >> 4) & 15, buf, cnt, dist)) return status::input;
+
+      bitbuf = buf, bitcnt = cnt;
+      if(!match(len, dist)) { mode = state::error; break; }
+      break;
+    }
+
+    case state::copy: {
+      copy();
+      if(remain) return status::output;
+      mode = state::codes;
+      break;
+    }
+
+    case state::done:
+      return status::finished;
+
+    case state::error:
+      return status::error;
+    }
+  }
+};
+
 }
 
+inline bool inflate(
+  uint8_t *target, unsigned targetLength,
+  const uint8_t *source, unsigned sourceLength
+) {
+  deflate::decoder d(target, targetLength, source, sourceLength);
+  return d.run() == 0;
 }
 
+typedef deflate::stream inflate_stream;
+
 }
 
 #endif
@@ -0,0 +1,101 @@
+#ifndef NALL_IPS_HPP
+#define NALL_IPS_HPP
+
+#include <string.h>
+#include <nall/algorithm.hpp>
+#include <nall/stdint.hpp>
+
+namespace nall {
+
+//IPS patches: "PATCH", then records of a 24-bit offset and 16-bit length followed by
+//that many bytes (or, with a zero length, a 16-bit run length and one fill byte),
+//terminated by "EOF" and an optional 24-bit size the target is truncated to.
+//the format has no checksums; only the structure of the patch is validated.
+struct ips {
+  enum class result : unsigned {
+    unknown,
+    success,
+    patch_invalid,
+    target_too_small,
+  };
+
+  //targetlength is the capacity of targetdata on entry, and the size of the patched
+  //file on return. if it does not fit, target_too_small is returned before anything is
+  //written, so the required size can be queried by passing a null target.
+  result apply(
+    const uint8_t *patchdata, unsigned patchlength,
+    const uint8_t *sourcedata, unsigned sourcelength,
+    uint8_t *targetdata, unsigned &targetlength
+  ) {
+    unsigned length = sourcelength;
+    if(scan(patchdata, patchlength, length) == false) return result::patch_invalid;
+    if(targetlength < length) {
+      targetlength = length;
+      return result::target_too_small;
+    }
+    targetlength = length;
+
+    unsigned copy = min(sourcelength, length);
+    memcpy(targetdata, sourcedata, copy);
+    memset(targetdata + copy, 0, length - copy);
+
+    const uint8_t *p = patchdata + 5;
+    while(true) {
+      unsigned offset = p[0] << 16 | p[1] << 8 | p[2];
+      if(offset == 0x454f46) break;  //"EOF"
+      unsigned size = p[3] << 8 | p[4];
+      p += 5;
+
+      //records past a truncated end are dropped
+      if(size) {
+        if(offset < length) memcpy(targetdata + offset, p, min(size, length - offset));
+        p += size;
+      } else {
+        unsigned run = p[0] << 8 | p[1];
+        if(offset < length) memset(targetdata + offset, p[2], min(run, length - offset));
+        p += 3;
+      }
+    }
+
+    return result::success;
+  }
+
+private:
+  //validates record bounds, and determines the size of the patched file
+  static bool scan(const uint8_t *patchdata, unsigned patchlength, unsigned &length) {
+    if(patchlength < 8 || memcmp(patchdata, "PATCH", 5)) return false;
+
+    unsigned p = 5;
+    while(true) {
+      if(p + 3 > patchlength) return false;
+      unsigned offset = patchdata[p] << 16 | patchdata[p + 1] << 8 | patchdata[p + 2];
+      if(offset == 0x454f46) {
+        p += 3;
+        break;
+      }
+
+      if(p + 5 > patchlength) return false;
+      unsigned size = patchdata[p + 3] << 8 | patchdata[p + 4];
+      p += 5;
+
+      if(size) {
+        if(p + size > patchlength) return false;
+        p += size;
+      } else {
+        if(p + 3 > patchlength) return false;
+        size = patchdata[p] << 8 | patchdata[p + 1];
+        p += 3;
+      }
+      length = max(length, offset + size);
+    }
+
+    if(p + 3 <= patchlength) {
+      length = patchdata[p] << 16 | patchdata[p + 1] << 8 | patchdata[p + 2];
+    }
+    return true;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef NALL_PATCH_HPP
+#define NALL_PATCH_HPP
+
+#include <string.h>
+#include <nall/bps.hpp>
+#include <nall/ips.hpp>
+#include <nall/stdint.hpp>
+#include <nall/ups.hpp>
+
+namespace nall {
+
+//applies IPS, UPS or BPS patches in memory, picking the format from the patch header.
+//source and patch are typically memory-mapped, so the only copy made is the target.
+struct patch {
+  enum class format : unsigned { unknown, ips, ups, bps };
+
+  static format detect(const uint8_t *patchdata, unsigned patchlength) {
+    if(patchlength >= 5 && !memcmp(patchdata, "PATCH", 5)) return format::ips;
+    if(patchlength >= 4 && !memcmp(patchdata, "UPS1", 4)) return format::ups;
+    if(patchlength >= 4 && !memcmp(patchdata, "BPS1", 4)) return format::bps;
+    return format::unknown;
+  }
+
+  //on success, targetdata is allocated with new[] and owned by the caller
+  static bool apply(
+    const uint8_t *patchdata, unsigned patchlength,
+    const uint8_t *sourcedata, unsigned sourcelength,
+    uint8_t *&targetdata, unsigned &targetlength
+  ) {
+    targetdata = 0;
+    targetlength = 0;
+
+    switch(detect(patchdata, patchlength)) {
+      case format::ips: return apply<ips>(patchdata, patchlength, sourcedata, sourcelength, targetdata, targetlength);
+      case format::ups: return apply<ups>(patchdata, patchlength, sourcedata, sourcelength, targetdata, targetlength);
+      case format::bps: return apply<bps>(patchdata, patchlength, sourcedata, sourcelength, targetdata, targetlength);
+      default: return false;
+    }
+  }
+
+private:
+  //the first pass only reads the headers to learn the target size
+  template<typename T> static bool apply(
+    const uint8_t *patchdata, unsigned patchlength,
+    const uint8_t *sourcedata, unsigned sourcelength,
+    uint8_t *&targetdata, unsigned &targetlength
+  ) {
+    T engine;
+    unsigned length = 0;
+    if(engine.apply(patchdata, patchlength, sourcedata, sourcelength, 0, length) != T::result::target_too_small) return false;
+
+    targetdata = new uint8_t[length ? length : 1];
+    targetlength = length;
+    if(engine.apply(patchdata, patchlength, sourcedata, sourcelength, targetdata, targetlength) == T::result::success) return true;
+
+    delete[] targetdata;
+    targetdata = 0;
+    targetlength = 0;
+    return false;
+  }
+};
+
+}
+
+#endif
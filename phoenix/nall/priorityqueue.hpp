@@ -2,6 +2,8 @@
 #define NALL_PRIORITYQUEUE_HPP
 
 #include <limits>
+#include <nall/algorithm.hpp>
+#include <nall/bit.hpp>
 #include <nall/function.hpp>
 #include <nall/serializer.hpp>
 #include <nall/utility.hpp>
@@ -9,18 +11,30 @@
 namespace nall {
   template<typename type_t> void priority_queue_nocallback(type_t) {}
 
-  //priority queue implementation using binary min-heap array;
+  //priority queue implementation using d-ary min-heap array;
   //does not require normalize() function.
+  //with four children per node, the children compared at each level sit next to each
+  //other in memory, and the heap is half as deep as a binary one.
   //O(1)     find   (tick)
   //O(log n) insert (enqueue)
   //O(log n) remove (dequeue)
-  template<typename type_t> class priority_queue {
+  template<typename type_t, unsigned arity = 4> class priority_queue {
   public:
     inline void tick(unsigned ticks) {
       basecounter += ticks;
       while(heapsize && gte(basecounter, heap[0].counter)) callback(dequeue());
     }
 
+    //advances time as tick() does, but takes every event that is now due out in one pass,
+    //in order, instead of calling callback for each; events must hold as many entries as
+    //the queue does. returns the number of events stored.
+    unsigned tick(unsigned ticks, type_t *events) {
+      basecounter += ticks;
+      unsigned count = 0;
+      while(heapsize && gte(basecounter, heap[0].counter)) events[count++] = dequeue();
+      return count;
+    }
+
     //counter is relative to current time (eg enqueue(64, ...) fires in 64 ticks);
     //counter cannot exceed std::numeric_limits<unsigned>::max() >> 1.
     void enqueue(unsigned counter, type_t event) {
@@ -28,11 +42,10 @@ namespace nall {
       counter += basecounter;
 
       while(child) {
-        unsigned parent = (child - 1) >> 1;
+        unsigned parent = (child - 1) / arity;
         if(gte(counter, heap[parent].counter)) break;
 
-        heap[child].counter = heap[parent].counter;
-        heap[child].event = heap[parent].event;
+        heap[child] = heap[parent];
         child = parent;
       }
 
@@ -42,22 +55,8 @@ namespace nall {
 
     type_t dequeue() {
       type_t event(heap[0].event);
-      unsigned parent = 0;
-      unsigned counter = heap[--heapsize].counter;
-
-      while(true) {
-        unsigned child = (parent << 1) + 1;
-        if(child >= heapsize) break;
-        if(child + 1 < heapsize && gte(heap[child].counter, heap[child + 1].counter)) child++;
-        if(gte(heap[child].counter, counter)) break;
-
-        heap[parent].counter = heap[child].counter;
-        heap[parent].event = heap[child].event;
-        parent = child;
-      }
-
-      heap[parent].counter = counter;
-      heap[parent].event = heap[heapsize].event;
+      heapsize--;
+      sift(0, heap[heapsize]);
       return event;
     }
 
@@ -66,6 +65,7 @@ namespace nall {
       heapsize = 0;
     }
 
+    //the heap is rebuilt after loading, so any array of events in the same format loads
     void serialize(serializer &s) {
       s.integer(basecounter);
       s.integer(heapsize);
@@ -73,6 +73,7 @@ namespace nall {
         s.integer(heap[n].counter);
         s.integer(heap[n].event);
       }
+      if(s.mode() == serializer::Load) rebuild();
     }
 
     priority_queue(unsigned size, function<void (type_t)> callback_ = &priority_queue_nocallback<type_t>)
@@ -103,6 +104,136 @@ namespace nall {
     inline bool gte(unsigned x, unsigned y) {
       return x - y < (std::numeric_limits<unsigned>::max() >> 1);
     }
+
+    //moves entry down from the hole at parent, to where it belongs.
+    //when a node has all its children, the lowest is picked without branching.
+    void sift(unsigned parent, heap_t entry) {
+      while(true) {
+        unsigned first = parent * arity + 1;
+        if(first >= heapsize) break;
+
+        unsigned child = first, counter = heap[first].counter;
+        if(first + arity <= heapsize) {
+          for(unsigned n = first + 1; n < first + arity; n++) {
+            bool lower = !gte(heap[n].counter, counter);
+            child = lower ? n : child;
+            counter = lower ? heap[n].counter : counter;
+          }
+        } else {
+          for(unsigned n = first + 1; n < heapsize; n++) {
+            if(!gte(heap[n].counter, counter)) child = n, counter = heap[n].counter;
+          }
+        }
+        if(gte(counter, entry.counter)) break;
+
+        heap[parent] = heap[child];
+        parent = child;
+      }
+
+      heap[parent] = entry;
+    }
+
+    void rebuild() {
+      if(heapsize < 2) return;
+      for(unsigned parent = (heapsize - 2) / arity + 1; parent--;) sift(parent, heap[parent]);
+    }
+  };
+
+  //priority queue implementation using ring buffer;
+  //does not require normalize() function.
+  //meant for events that are enqueued in the order they fire, eg all with the same period.
+  //an event that fires before ones already queued is inserted from the back, which stays
+  //correct, but costs one move per event it passes.
+  //size is rounded up to a power of two.
+  //O(1) find   (tick)
+  //O(1) insert (enqueue), O(n) when out of order
+  //O(1) remove (dequeue)
+  template<typename type_t> class priority_ring {
+  public:
+    inline void tick(unsigned ticks) {
+      basecounter += ticks;
+      while(ringsize && gte(basecounter, ring[ringhead].counter)) callback(dequeue());
+    }
+
+    //see priority_queue::tick(unsigned, type_t*)
+    unsigned tick(unsigned ticks, type_t *events) {
+      basecounter += ticks;
+      unsigned count = 0;
+      while(ringsize && gte(basecounter, ring[ringhead].counter)) events[count++] = dequeue();
+      return count;
+    }
+
+    //counter is relative to current time (eg enqueue(64, ...) fires in 64 ticks);
+    //counter cannot exceed std::numeric_limits<unsigned>::max() >> 1.
+    void enqueue(unsigned counter, type_t event) {
+      unsigned position = (ringhead + ringsize++) & ringmask;
+      counter += basecounter;
+
+      while(position != ringhead) {
+        unsigned previous = (position - 1) & ringmask;
+        if(gte(counter, ring[previous].counter)) break;
+
+        ring[position] = ring[previous];
+        position = previous;
+      }
+
+      ring[position].counter = counter;
+      ring[position].event = event;
+    }
+
+    type_t dequeue() {
+      type_t event(ring[ringhead].event);
+      ringhead = (ringhead + 1) & ringmask;
+      ringsize--;
+      return event;
+    }
+
+    void reset() {
+      basecounter = 0;
+      ringhead = 0;
+      ringsize = 0;
+    }
+
+    void serialize(serializer &s) {
+      s.integer(basecounter);
+      s.integer(ringhead);
+      s.integer(ringsize);
+      for(unsigned n = 0; n <= ringmask; n++) {
+        s.integer(ring[n].counter);
+        s.integer(ring[n].event);
+      }
+    }
+
+    priority_ring(unsigned size, function<void (type_t)> callback_ = &priority_queue_nocallback<type_t>)
+    : callback(callback_) {
+      size = bit::round(size ? size : 1);
+      ring = new ring_t[size];
+      ringmask = size - 1;
+      reset();
+    }
+
+    ~priority_ring() {
+      delete[] ring;
+    }
+
+    priority_ring& operator=(const priority_ring&) = delete;
+    priority_ring(const priority_ring&) = delete;
+
+  private:
+    function<void (type_t)> callback;
+    unsigned basecounter;
+    unsigned ringhead;
+    unsigned ringsize;
+    unsigned ringmask;
+    struct ring_t {
+      unsigned counter;
+      type_t event;
+    } *ring;
+
+    //return true if x is greater than or equal to y
+    inline bool gte(unsigned x, unsigned y) {
+      return x - y < (std::numeric_limits<unsigned>::max() >> 1);
+    }
   };
 }
 
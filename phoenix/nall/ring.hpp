@@ -0,0 +1,75 @@
+#ifndef NALL_RING_HPP
+#define NALL_RING_HPP
+
+#include <atomic>
+#include <nall/bit.hpp>
+#include <nall/algorithm.hpp>
+
+namespace nall {
+  //single-producer, single-consumer ring buffer.
+  //one thread writes and another reads, without locking: each side only advances its own
+  //index, and publishes it with release semantics once the data behind it is complete.
+  //both sides work on contiguous spans in place, so data is copied in and out at most once.
+  //capacity is rounded up to a power of two; indices wrap freely.
+  template<typename T> struct ring {
+    //contiguous free space available to the producer; 0 when full
+    inline unsigned reserve(T *&data) {
+      unsigned head = producer.load(std::memory_order_relaxed);
+      unsigned tail = consumer.load(std::memory_order_acquire);
+      unsigned offset = head & mask;
+      data = pool + offset;
+      return min(capacity - (head - tail), capacity - offset);
+    }
+
+    //publishes length elements written into the span returned by reserve()
+    inline void commit(unsigned length) {
+      producer.store(producer.load(std::memory_order_relaxed) + length, std::memory_order_release);
+    }
+
+    //contiguous data available to the consumer; 0 when empty
+    inline unsigned peek(const T *&data) {
+      unsigned tail = consumer.load(std::memory_order_relaxed);
+      unsigned head = producer.load(std::memory_order_acquire);
+      unsigned offset = tail & mask;
+      data = pool + offset;
+      return min(head - tail, capacity - offset);
+    }
+
+    //releases length elements returned by peek() back to the producer
+    inline void consume(unsigned length) {
+      consumer.store(consumer.load(std::memory_order_relaxed) + length, std::memory_order_release);
+    }
+
+    inline unsigned size() const {
+      return producer.load(std::memory_order_acquire) - consumer.load(std::memory_order_acquire);
+    }
+
+    inline bool empty() const { return size() == 0; }
+
+    //only valid while neither side is active
+    inline void reset() {
+      producer.store(0);
+      consumer.store(0);
+    }
+
+    inline ring(unsigned size) : capacity(bit::round(size)), mask(capacity - 1), producer(0), consumer(0) {
+      pool = new T[capacity];
+    }
+
+    inline ~ring() {
+      delete[] pool;
+    }
+
+    ring(const ring&) = delete;
+    ring& operator=(const ring&) = delete;
+
+  private:
+    T *pool;
+    unsigned capacity;
+    unsigned mask;
+    std::atomic<unsigned> producer;
+    std::atomic<unsigned> consumer;
+  };
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 //author: vladitx
 
+#include <nall/cpuid.hpp>
 #include <nall/stdint.hpp>
 
 namespace nall {
@@ -46,47 +47,184 @@ namespace nall {
     uint8_t in[64];
     unsigned inlen;
 
-    uint32_t w[64];
     uint32_t h[8];
     uint64_t len;
   };
 
-  inline void sha256_init(sha256_ctx *p) {
-    memset(p, 0, sizeof(sha256_ctx));
-    memcpy(p->h, T_H, sizeof(T_H));
-  }
-
-  static void sha256_block(sha256_ctx *p) {
+  //portable C implementation
+  inline void sha256_compress_c(uint32_t *hash, const uint8_t *in, unsigned blocks) {
     unsigned i;
+    uint32_t w[64];
     uint32_t s0, s1;
     uint32_t a, b, c, d, e, f, g, h;
     uint32_t t1, t2, maj, ch;
 
-    for(i = 0; i < 16; i++) p->w[i] = LD32BE(p->in + i * 4);
+    for(; blocks; blocks--, in += 64) {
+      //input may be unaligned when hashing directly from the caller's buffer
+      for(i = 0; i < 16; i++) {
+        w[i] = LSL32(in[i * 4 + 0], 24) | LSL32(in[i * 4 + 1], 16) | LSL32(in[i * 4 + 2], 8) | in[i * 4 + 3];
+      }
 
-    for(i = 16; i < 64; i++) {
-      s0 = ROR32(p->w[i - 15],  7) ^ ROR32(p->w[i - 15], 18) ^ LSR32(p->w[i - 15],  3);
-      s1 = ROR32(p->w[i -  2], 17) ^ ROR32(p->w[i -  2], 19) ^ LSR32(p->w[i -  2], 10);
-      p->w[i] = p->w[i - 16] + s0 + p->w[i - 7] + s1;
+      for(i = 16; i < 64; i++) {
+        s0 = ROR32(w[i - 15],  7) ^ ROR32(w[i - 15], 18) ^ LSR32(w[i - 15],  3);
+        s1 = ROR32(w[i -  2], 17) ^ ROR32(w[i -  2], 19) ^ LSR32(w[i -  2], 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+      a = hash[0]; b = hash[1]; c = hash[2]; d = hash[3];
+      e = hash[4]; f = hash[5]; g = hash[6]; h = hash[7];
+
+      for(i = 0; i < 64; i++) {
+        s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+        maj = (a & b) ^ (a & c) ^ (b & c);
+        t2 = s0 + maj;
+        s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+        ch = (e & f) ^ (~e & g);
+        t1 = h + s1 + ch + T_K[i] + w[i];
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+      }
+
+      hash[0] += a; hash[1] += b; hash[2] += c; hash[3] += d;
+      hash[4] += e; hash[5] += f; hash[6] += g; hash[7] += h;
     }
+  }
+
+  #if defined(NALL_CPUID_X86)
+  //SHA extensions (SHA-NI); four rounds per sha256rnds2 pair
+  __attribute__((target("sha,sse4.1,ssse3")))
+  inline void sha256_compress_sha(uint32_t *hash, const uint8_t *in, unsigned blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i state0, state1, msg, tmp, m[4];
+
+    tmp    = _mm_loadu_si128((const __m128i*)(hash + 0));
+    state1 = _mm_loadu_si128((const __m128i*)(hash + 4));
+    tmp    = _mm_shuffle_epi32(tmp, 0xb1);              //CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1b);           //EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);           //ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);        //CDGH
+
+    for(; blocks; blocks--, in += 64) {
+      __m128i abef = state0, cdgh = state1;
 
-    a = p->h[0]; b = p->h[1]; c = p->h[2]; d = p->h[3];
-    e = p->h[4]; f = p->h[5]; g = p->h[6]; h = p->h[7];
+      #pragma GCC unroll 16
+      for(unsigned i = 0; i < 16; i++) {
+        if(i < 4) m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + i * 16)), mask);
 
-    for(i = 0; i < 64; i++) {
-      s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
-      maj = (a & b) ^ (a & c) ^ (b & c);
-      t2 = s0 + maj;
-      s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
-      ch = (e & f) ^ (~e & g);
-      t1 = h + s1 + ch + T_K[i] + p->w[i];
+        msg = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i*)(T_K + i * 4)));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        if(i >= 3 && i <= 14) {
+          tmp = _mm_alignr_epi8(m[i & 3], m[(i + 3) & 3], 4);
+          m[(i + 1) & 3] = _mm_add_epi32(m[(i + 1) & 3], tmp);
+          m[(i + 1) & 3] = _mm_sha256msg2_epu32(m[(i + 1) & 3], m[i & 3]);
+        }
+        msg = _mm_shuffle_epi32(msg, 0x0e);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        if(i >= 1 && i <= 12) m[(i + 3) & 3] = _mm_sha256msg1_epu32(m[(i + 3) & 3], m[i & 3]);
+      }
 
-      h = g; g = f; f = e; e = d + t1;
-      d = c; c = b; b = a; a = t1 + t2;
+      state0 = _mm_add_epi32(state0, abef);
+      state1 = _mm_add_epi32(state1, cdgh);
     }
 
-    p->h[0] += a; p->h[1] += b; p->h[2] += c; p->h[3] += d;
-    p->h[4] += e; p->h[5] += f; p->h[6] += g; p->h[7] += h;
+    tmp    = _mm_shuffle_epi32(state0, 0x1b);           //FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);           //DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);        //DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);           //HGFE
+    _mm_storeu_si128((__m128i*)(hash + 0), state0);
+    _mm_storeu_si128((__m128i*)(hash + 4), state1);
+  }
+
+  //AVX2 multi-buffer: one block from each of eight independent messages.
+  //state[n][lane] holds word n of each lane's hash.
+  __attribute__((target("avx2")))
+  inline void sha256_compress_x8(uint32_t state[8][8], const uint8_t *const in[8]) {
+    #define ROR256(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+    const __m256i bswap = _mm256_set_epi8(
+      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3
+    );
+    __m256i w[16], r[8], t[8], u[8];
+
+    //transpose 8x8 words so that w[n] holds word n of every lane
+    for(unsigned half = 0; half < 2; half++) {
+      for(unsigned l = 0; l < 8; l++) r[l] = _mm256_loadu_si256((const __m256i*)(in[l] + half * 32));
+      for(unsigned l = 0; l < 8; l += 2) {
+        t[l + 0] = _mm256_unpacklo_epi32(r[l], r[l + 1]);
+        t[l + 1] = _mm256_unpackhi_epi32(r[l], r[l + 1]);
+      }
+      for(unsigned l = 0; l < 8; l += 4) {
+        u[l + 0] = _mm256_unpacklo_epi64(t[l + 0], t[l + 2]);
+        u[l + 1] = _mm256_unpackhi_epi64(t[l + 0], t[l + 2]);
+        u[l + 2] = _mm256_unpacklo_epi64(t[l + 1], t[l + 3]);
+        u[l + 3] = _mm256_unpackhi_epi64(t[l + 1], t[l + 3]);
+      }
+      for(unsigned l = 0; l < 4; l++) {
+        w[half * 8 + l + 0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[l], u[l + 4], 0x20), bswap);
+        w[half * 8 + l + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[l], u[l + 4], 0x31), bswap);
+      }
+    }
+
+    __m256i a = _mm256_loadu_si256((const __m256i*)state[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i*)state[1]);
+    __m256i c = _mm256_loadu_si256((const __m256i*)state[2]);
+    __m256i d = _mm256_loadu_si256((const __m256i*)state[3]);
+    __m256i e = _mm256_loadu_si256((const __m256i*)state[4]);
+    __m256i f = _mm256_loadu_si256((const __m256i*)state[5]);
+    __m256i g = _mm256_loadu_si256((const __m256i*)state[6]);
+    __m256i h = _mm256_loadu_si256((const __m256i*)state[7]);
+
+    for(unsigned i = 0; i < 64; i++) {
+      if(i >= 16) {
+        __m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROR256(w15,  7), ROR256(w15, 18)), _mm256_srli_epi32(w15,  3));
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROR256(w2, 17), ROR256(w2, 19)), _mm256_srli_epi32(w2, 10));
+        w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i - 7) & 15], s1));
+      }
+
+      __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROR256(e, 6), ROR256(e, 11)), ROR256(e, 25));
+      __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+      __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, w[i & 15]));
+      t1 = _mm256_add_epi32(t1, _mm256_set1_epi32(T_K[i]));
+      __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROR256(a, 2), ROR256(a, 13)), ROR256(a, 22));
+      __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+      __m256i t2 = _mm256_add_epi32(s0, maj);
+
+      h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+      d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+    }
+
+    #define ACCUMULATE(n, x) _mm256_storeu_si256((__m256i*)state[n], _mm256_add_epi32(x, _mm256_loadu_si256((const __m256i*)state[n])))
+    ACCUMULATE(0, a); ACCUMULATE(1, b); ACCUMULATE(2, c); ACCUMULATE(3, d);
+    ACCUMULATE(4, e); ACCUMULATE(5, f); ACCUMULATE(6, g); ACCUMULATE(7, h);
+    #undef ACCUMULATE
+    #undef ROR256
+  }
+  #endif
+
+  typedef void (*sha256_compress_t)(uint32_t*, const uint8_t*, unsigned);
+
+  inline sha256_compress_t sha256_compress_select() {
+    #if defined(NALL_CPUID_X86)
+    if(cpuid::supports(cpuid::sha | cpuid::sse41 | cpuid::ssse3)) return sha256_compress_sha;
+    #endif
+    return sha256_compress_c;
+  }
+
+  //processes whole 64-byte blocks with the fastest implementation the CPU supports
+  inline void sha256_compress(uint32_t *hash, const uint8_t *in, unsigned blocks) {
+    static sha256_compress_t compress = sha256_compress_select();
+    compress(hash, in, blocks);
+  }
+
+  inline void sha256_init(sha256_ctx *p) {
+    memset(p, 0, sizeof(sha256_ctx));
+    memcpy(p->h, T_H, sizeof(T_H));
+  }
+
+  static void sha256_block(sha256_ctx *p) {
+    sha256_compress(p->h, p->in, 1);
 
     //next block
     p->inlen = 0;
@@ -97,6 +235,15 @@ namespace nall {
     p->len += len;
 
     while(len) {
+      //consume whole blocks directly from the source when no partial block is pending
+      if(p->inlen == 0 && len >= 64) {
+        l = len >> 6;
+        sha256_compress(p->h, s, l);
+        s += l << 6;
+        len -= l << 6;
+        continue;
+      }
+
       l = 64 - p->inlen;
       l = (len < l) ? len : l;
 
@@ -131,6 +278,108 @@ namespace nall {
     for(unsigned i = 0; i < 8; i++) ST32BE(t++, p->h[i]);
   }
 
+  #if defined(NALL_CPUID_X86)
+  //one lane of the multi-buffer scheduler: whole blocks are read in place,
+  //the final partial block and padding are staged in tail
+  struct sha256_lane {
+    unsigned item;
+    const uint8_t *data;
+    unsigned blocks;
+    unsigned tails, tailpos;
+    uint8_t tail[128];
+  };
+
+  inline void sha256_lane_load(sha256_lane &lane, unsigned item, const uint8_t *data, unsigned length) {
+    unsigned remain = length & 63;
+    lane.item = item;
+    lane.data = data;
+    lane.blocks = length >> 6;
+    lane.tails = remain + 9 > 64 ? 2 : 1;
+    lane.tailpos = 0;
+    memset(lane.tail, 0, sizeof lane.tail);
+    memcpy(lane.tail, data + (length & ~63), remain);
+    lane.tail[remain] = 0x80;
+    uint64_t bits = (uint64_t)length << 3;
+    ST32BE(lane.tail + lane.tails * 64 - 8, bits >> 32);
+    ST32BE(lane.tail + lane.tails * 64 - 4, bits);
+  }
+
+  inline const uint8_t* sha256_lane_next(sha256_lane &lane) {
+    if(lane.blocks) { lane.blocks--; lane.data += 64; return lane.data - 64; }
+    return lane.tail + lane.tailpos++ * 64;
+  }
+
+  inline bool sha256_lane_done(const sha256_lane &lane) {
+    return lane.blocks == 0 && lane.tailpos == lane.tails;
+  }
+
+  //schedules up to eight buffers at a time onto the AVX2 lanes;
+  //a lane is refilled with the next buffer as soon as its message is complete
+  inline void sha256_batch_x8(const uint8_t *const data[], const unsigned length[], unsigned count, uint8_t *hash) {
+    static const uint8_t zero[64] = {0};
+    sha256_lane lane[8];
+    const uint8_t *block[8];
+    uint32_t state[8][8];
+    unsigned next = 0, active = 0;
+
+    for(unsigned l = 0; l < 8 && next < count; l++, next++) {
+      sha256_lane_load(lane[l], next, data[next], length[next]);
+      for(unsigned n = 0; n < 8; n++) state[n][l] = T_H[n];
+      active |= 1 << l;
+    }
+
+    while(active & (active - 1)) {
+      for(unsigned l = 0; l < 8; l++) {
+        block[l] = (active & (1 << l)) ? sha256_lane_next(lane[l]) : zero;
+      }
+      sha256_compress_x8(state, block);
+
+      for(unsigned l = 0; l < 8; l++) {
+        if(!(active & (1 << l)) || !sha256_lane_done(lane[l])) continue;
+        uint8_t *output = hash + lane[l].item * 32;
+        for(unsigned n = 0; n < 8; n++) ST32BE(output + n * 4, state[n][l]);
+        active &= ~(1 << l);
+        if(next < count) {
+          sha256_lane_load(lane[l], next, data[next], length[next]);
+          for(unsigned n = 0; n < 8; n++) state[n][l] = T_H[n];
+          active |= 1 << l;
+          next++;
+        }
+      }
+    }
+
+    //finish the last remaining lane with the single-buffer path
+    for(unsigned l = 0; l < 8; l++) {
+      if(!(active & (1 << l))) continue;
+      uint32_t h[8];
+      for(unsigned n = 0; n < 8; n++) h[n] = state[n][l];
+      sha256_compress(h, lane[l].data, lane[l].blocks);
+      sha256_compress(h, lane[l].tail + lane[l].tailpos * 64, lane[l].tails - lane[l].tailpos);
+      uint8_t *output = hash + lane[l].item * 32;
+      for(unsigned n = 0; n < 8; n++) ST32BE(output + n * 4, h[n]);
+    }
+  }
+  #endif
+
+  //hashes count independent buffers; writes 32 bytes per buffer to hash.
+  //with SHA-NI each buffer is hashed in turn (already faster than eight AVX2 lanes);
+  //otherwise AVX2 processes up to eight buffers at once.
+  inline void sha256_batch(const uint8_t *const data[], const unsigned length[], unsigned count, uint8_t *hash) {
+    #if defined(NALL_CPUID_X86)
+    if(count > 1 && cpuid::supports(cpuid::avx2) && !cpuid::supports(cpuid::sha | cpuid::sse41 | cpuid::ssse3)) {
+      return sha256_batch_x8(data, length, count, hash);
+    }
+    #endif
+
+    for(unsigned i = 0; i < count; i++) {
+      sha256_ctx sha;
+      sha256_init(&sha);
+      sha256_chunk(&sha, data[i], length[i]);
+      sha256_final(&sha);
+      sha256_hash(&sha, hash + i * 32);
+    }
+  }
+
   #undef PTR
   #undef SWAP32
   #undef ST32
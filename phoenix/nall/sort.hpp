@@ -1,61 +1,323 @@
 #ifndef NALL_SORT_HPP
 #define NALL_SORT_HPP
 
+#include <nall/algorithm.hpp>
+#include <nall/thread.hpp>
 #include <nall/utility.hpp>
 
-//class:   merge sort
-//average: O(n log n)
-//worst:   O(n log n)
-//memory:  O(n)
-//stack:   O(log n)
-//stable?: yes
-
-//notes:
-//there are two primary reasons for choosing merge sort
-//over the (usually) faster quick sort*:
-//1: it is a stable sort.
-//2: it lacks O(n^2) worst-case overhead.
-//(* which is also O(n log n) in the average case.)
+//sort:         pattern-defeating quick sort
+//average:      O(n log n), O(n) for sorted, reversed and few-distinct-value input
+//worst:        O(n log n), by falling back to heap sort
+//memory:       O(1)
+//stable?:      no
+//
+//stable_sort:  merge sort
+//average:      O(n log n), O(n) for sorted input
+//worst:        O(n log n)
+//memory:       O(n / 2), allocated once
+//stable?:      yes
+//
+//parallel_sort: sort() on separate threads, then parallel merges
+//memory:       O(n)
+//stable?:      no
+//
+//elements are moved, never copied, so lists of strings sort without allocating.
 
 namespace nall {
+  template<typename T> void sort_insertion(T *begin, T *end) {
+    if(begin == end) return;
+    for(T *current = begin + 1; current != end; current++) {
+      if(*current < *(current - 1)) {
+        T value(std::move(*current));
+        T *sift = current;
+        do {
+          *sift = std::move(*(sift - 1));
+          sift--;
+        } while(sift != begin && value < *(sift - 1));
+        *sift = std::move(value);
+      }
+    }
+  }
+
+  //the element before begin must not be greater than any in the range
+  template<typename T> void sort_insertion_unguarded(T *begin, T *end) {
+    if(begin == end) return;
+    for(T *current = begin + 1; current != end; current++) {
+      if(*current < *(current - 1)) {
+        T value(std::move(*current));
+        T *sift = current;
+        do {
+          *sift = std::move(*(sift - 1));
+          sift--;
+        } while(value < *(sift - 1));
+        *sift = std::move(value);
+      }
+    }
+  }
+
+  //gives up once more than eight elements had to be moved
+  template<typename T> bool sort_insertion_partial(T *begin, T *end) {
+    if(begin == end) return true;
+    unsigned moved = 0;
+    for(T *current = begin + 1; current != end; current++) {
+      if(*current < *(current - 1)) {
+        T value(std::move(*current));
+        T *sift = current;
+        do {
+          *sift = std::move(*(sift - 1));
+          sift--;
+        } while(sift != begin && value < *(sift - 1));
+        *sift = std::move(value);
+        moved += current - sift;
+      }
+      if(moved > 8) return false;
+    }
+    return true;
+  }
+
+  template<typename T> void sort_sift(T *heap, unsigned root, unsigned length) {
+    T value(std::move(heap[root]));
+    while(true) {
+      unsigned child = root * 2 + 1;
+      if(child >= length) break;
+      if(child + 1 < length && heap[child] < heap[child + 1]) child++;
+      if(!(value < heap[child])) break;
+      heap[root] = std::move(heap[child]);
+      root = child;
+    }
+    heap[root] = std::move(value);
+  }
+
+  template<typename T> void sort_heap(T *begin, T *end) {
+    unsigned length = end - begin;
+    for(unsigned n = length / 2; n--;) sort_sift(begin, n, length);
+    while(length > 1) {
+      swap(begin[0], begin[--length]);
+      sort_sift(begin, 0, length);
+    }
+  }
+
+  template<typename T> void sort_order(T *a, T *b) {
+    if(*b < *a) swap(*a, *b);
+  }
+
+  template<typename T> void sort_order(T *a, T *b, T *c) {
+    sort_order(a, b);
+    sort_order(b, c);
+    sort_order(a, b);
+  }
+
+  //partitions around *begin, placing elements equal to it on the right.
+  //returns the final pivot position; partitioned is set when no elements had to be swapped.
+  template<typename T> T* sort_partition_right(T *begin, T *end, bool &partitioned) {
+    T pivot(std::move(*begin));
+    T *first = begin, *last = end;
+
+    //the median-of-three guarantees an element >= pivot before end, and <= pivot at begin
+    while(*++first < pivot);
+    if(first - 1 == begin) {
+      while(first < last && !(*--last < pivot));
+    } else {
+      while(!(*--last < pivot));
+    }
+
+    partitioned = first >= last;
+    while(first < last) {
+      swap(*first, *last);
+      while(*++first < pivot);
+      while(!(*--last < pivot));
+    }
+
+    T *position = first - 1;
+    *begin = std::move(*position);
+    *position = std::move(pivot);
+    return position;
+  }
+
+  //partitions around *begin, placing elements equal to it on the left.
+  //used when the pivot equals the element before the range, so every element
+  //equal to it is already in its final place.
+  template<typename T> T* sort_partition_left(T *begin, T *end) {
+    T pivot(std::move(*begin));
+    T *first = begin, *last = end;
+
+    while(pivot < *--last);
+    if(last + 1 == end) {
+      while(first < last && !(pivot < *++first));
+    } else {
+      while(!(pivot < *++first));
+    }
+
+    while(first < last) {
+      swap(*first, *last);
+      while(pivot < *--last);
+      while(!(pivot < *++first));
+    }
+
+    T *position = last;
+    *begin = std::move(*position);
+    *position = std::move(pivot);
+    return position;
+  }
+
+  template<typename T> void sort_quick(T *begin, T *end, unsigned badAllowed, bool leftmost) {
+    enum : unsigned { insertionLimit = 24, nintherLimit = 128 };
+
+    while(true) {
+      unsigned size = end - begin;
+      if(size < insertionLimit) {
+        if(leftmost) sort_insertion(begin, end);
+        else sort_insertion_unguarded(begin, end);
+        return;
+      }
+
+      //median-of-three, or pseudo-median of nine for large ranges, moved to begin
+      unsigned half = size / 2;
+      if(size > nintherLimit) {
+        sort_order(begin, begin + half, end - 1);
+        sort_order(begin + 1, begin + (half - 1), end - 2);
+        sort_order(begin + 2, begin + (half + 1), end - 3);
+        sort_order(begin + (half - 1), begin + half, begin + (half + 1));
+        swap(*begin, *(begin + half));
+      } else {
+        sort_order(begin + half, begin, end - 1);
+      }
+
+      if(!leftmost && !(*(begin - 1) < *begin)) {
+        begin = sort_partition_left(begin, end) + 1;
+        continue;
+      }
+
+      bool partitioned;
+      T *pivot = sort_partition_right(begin, end, partitioned);
+      unsigned leftSize = pivot - begin, rightSize = end - (pivot + 1);
+
+      if(leftSize < size / 8 || rightSize < size / 8) {
+        //a bad split: after too many, fall back to heap sort; otherwise break up
+        //whatever pattern caused it by swapping a few elements around
+        if(--badAllowed == 0) return sort_heap(begin, end);
+
+        if(leftSize >= insertionLimit) {
+          swap(*begin, *(begin + leftSize / 4));
+          swap(*(pivot - 1), *(pivot - leftSize / 4));
+          if(leftSize > nintherLimit) {
+            swap(*(begin + 1), *(begin + (leftSize / 4 + 1)));
+            swap(*(begin + 2), *(begin + (leftSize / 4 + 2)));
+            swap(*(pivot - 2), *(pivot - (leftSize / 4 + 1)));
+            swap(*(pivot - 3), *(pivot - (leftSize / 4 + 2)));
+          }
+        }
+
+        if(rightSize >= insertionLimit) {
+          swap(*(pivot + 1), *(pivot + (1 + rightSize / 4)));
+          swap(*(end - 1), *(end - rightSize / 4));
+          if(rightSize > nintherLimit) {
+            swap(*(pivot + 2), *(pivot + (2 + rightSize / 4)));
+            swap(*(pivot + 3), *(pivot + (3 + rightSize / 4)));
+            swap(*(end - 2), *(end - (1 + rightSize / 4)));
+            swap(*(end - 3), *(end - (2 + rightSize / 4)));
+          }
+        }
+      } else if(partitioned) {
+        //input that was already in order needs no further partitioning
+        if(sort_insertion_partial(begin, pivot) && sort_insertion_partial(pivot + 1, end)) return;
+      }
+
+      //recurse into the left side, and loop on the right
+      sort_quick(begin, pivot, badAllowed, leftmost);
+      begin = pivot + 1;
+      leftmost = false;
+    }
+  }
+
   template<typename T>
   void sort(T list[], unsigned length) {
     if(length <= 1) return;  //nothing to sort
+    unsigned badAllowed = 0;  //log2(length) bad partitions before falling back to heap sort
+    for(unsigned n = length; n; n >>= 1) badAllowed++;
+    sort_quick(list, list + length, badAllowed, true);
+  }
 
-    //use insertion sort to quickly sort smaller blocks
-    if(length < 64) {
-      for(unsigned i = 0; i < length; i++) {
-        unsigned min = i;
-        for(unsigned j = i + 1; j < length; j++) {
-          if(list[j] < list[min]) min = j;
-        }
-        if(min != i) swap(list[i], list[min]);
-      }
-      return;
+  //merges two sorted ranges into target; on ties the element from left comes first
+  template<typename T> void sort_merge(T *left, unsigned leftLength, T *right, unsigned rightLength, T *target) {
+    T *leftEnd = left + leftLength, *rightEnd = right + rightLength;
+    while(left < leftEnd && right < rightEnd) {
+      if(*right < *left) *target++ = std::move(*right++);
+      else *target++ = std::move(*left++);
     }
+    while(left < leftEnd) *target++ = std::move(*left++);
+    while(right < rightEnd) *target++ = std::move(*right++);
+  }
+
+  //buffer must hold at least (length + 1) / 2 elements
+  template<typename T> void sort_stable(T *list, unsigned length, T *buffer) {
+    if(length < 32) return sort_insertion(list, list + length);
 
-    //split list in half and recursively sort both
     unsigned middle = length / 2;
-    sort(list, middle);
-    sort(list + middle, length - middle);
+    sort_stable(list, middle, buffer);
+    sort_stable(list + middle, length - middle, buffer);
+    if(!(list[middle] < list[middle - 1])) return;  //halves are already in order
+
+    //the left half moves out of the way, and is merged back with the right half in place
+    for(unsigned n = 0; n < middle; n++) buffer[n] = std::move(list[n]);
+    sort_merge(buffer, middle, list + middle, length - middle, list);
+  }
+
+  template<typename T>
+  void stable_sort(T list[], unsigned length) {
+    if(length <= 1) return;
+    if(length < 32) return sort_insertion(list, list + length);
+    T *buffer = new T[(length + 1) / 2];
+    sort_stable(list, length, buffer);
+    delete[] buffer;
+  }
+
+  template<typename T> void sort_thread(T *list, unsigned length) {
+    sort(list, length);
+  }
 
-    //left and right are sorted here; perform merge sort
+  //lists are split into at least 32768 elements per thread; smaller ones are not worth it
+  template<typename T>
+  void parallel_sort(T list[], unsigned length, unsigned threads = 0) {
+    if(threads == 0) threads = thread::processors();
+    threads = min(threads, length >> 15);
+    if(threads <= 1) return sort(list, length);
+
+    unsigned *bounds = new unsigned[threads + 1];
+    for(unsigned n = 0; n <= threads; n++) bounds[n] = (uint64_t)length * n / threads;
+
+    thread *workers = new thread[threads];
+    for(unsigned n = 0; n < threads; n++) {
+      workers[n] = thread(&sort_thread<T>, list + bounds[n], bounds[n + 1] - bounds[n]);
+    }
+    for(unsigned n = 0; n < threads; n++) workers[n].join();
+
+    //merge neighbouring runs pairwise, alternating between the list and a buffer
     T *buffer = new T[length];
-    unsigned offset = 0;
-    unsigned left   = 0;
-    unsigned right  = middle;
-    while(left < middle && right < length) {
-      if(list[left] < list[right]) {
-        buffer[offset++] = list[left++];
-      } else {
-        buffer[offset++] = list[right++];
+    T *source = list, *target = buffer;
+    for(unsigned runs = threads; runs > 1; runs = (runs + 1) / 2) {
+      unsigned pairs = runs / 2;
+      for(unsigned n = 0; n < pairs; n++) {
+        unsigned a = bounds[n * 2], b = bounds[n * 2 + 1], c = bounds[n * 2 + 2];
+        workers[n] = thread(&sort_merge<T>, source + a, b - a, source + b, c - b, target + a);
+      }
+      if(runs & 1) {
+        for(unsigned n = bounds[runs - 1]; n < length; n++) target[n] = std::move(source[n]);
       }
+      for(unsigned n = 0; n < pairs; n++) workers[n].join();
+
+      for(unsigned n = 0; n < pairs; n++) bounds[n] = bounds[n * 2];
+      if(runs & 1) bounds[pairs] = bounds[runs - 1];
+      bounds[(runs + 1) / 2] = length;
+      swap(source, target);
+    }
+    if(source != list) {
+      for(unsigned n = 0; n < length; n++) list[n] = std::move(source[n]);
     }
-    while(left  < middle) buffer[offset++] = list[left++];
-    while(right < length) buffer[offset++] = list[right++];
 
-    for(unsigned i = 0; i < length; i++) list[i] = buffer[i];
     delete[] buffer;
+    delete[] workers;
+    delete[] bounds;
   }
 }
 
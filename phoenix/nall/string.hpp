@@ -3,6 +3,7 @@
 
 #include <initializer_list>
 #include <nall/array.hpp>
+#include <nall/cpuid.hpp>
 #include <nall/platform.hpp>
 #include <nall/sha256.hpp>
 #include <nall/utility.hpp>
@@ -15,6 +16,7 @@
 #include <nall/string/convert.hpp>
 #include <nall/string/filename.hpp>
 #include <nall/string/math.hpp>
+#include <nall/string/number.hpp>
 #include <nall/string/platform.hpp>
 #include <nall/string/strl.hpp>
 #include <nall/string/strpos.hpp>
@@ -23,6 +25,7 @@
 #include <nall/string/split.hpp>
 #include <nall/string/utility.hpp>
 #include <nall/string/variadic.hpp>
+#include <nall/string/view.hpp>
 #include <nall/string/wrapper.hpp>
 #include <nall/string/xml.hpp>
 
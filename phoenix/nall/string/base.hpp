@@ -1,6 +1,7 @@
 #ifndef NALL_STRING_BASE_HPP
 #define NALL_STRING_BASE_HPP
 
+#include <float.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -80,10 +81,21 @@ namespace nall {
     //internal functions
     inline string& assign_(const char*);
     inline string& append_(const char*);
+    inline string& append_(const char*, unsigned);
 
   protected:
-    char *data;
-    unsigned size;
+    //strings of up to 23 characters are stored inline, longer ones on the heap.
+    //there is no pointer to the inline buffer, so a string may be moved with memcpy.
+    enum : unsigned { inline_size = 23 };
+    union {
+      char *pointer;
+      char buffer[inline_size + 1];
+    };
+    unsigned size;  //capacity, not counting the terminator
+    mutable unsigned used;  //length, or ~0u after raw writes through operator() or operator[]
+
+    inline char* data();
+    inline const char* data() const;
 
     template<unsigned Limit, bool Insensitive, bool Quoted> inline string& ureplace(const char*, const char*);
 
@@ -110,6 +122,81 @@ namespace nall {
     template<unsigned Limit, bool Insensitive, bool Quoted> inline lstring& usplit(const char*, const char*);
   };
 
+  template<> struct is_relocatable<string> { enum { value = true }; };
+  template<> struct is_relocatable<lstring> { enum { value = true }; };
+
+  //non-owning reference to a run of characters, which need not be null-terminated.
+  //it is only valid while the characters it refers to are.
+  struct string_view {
+    const char *data;
+    unsigned size;
+
+    inline unsigned length() const;
+    inline bool empty() const;
+    inline char operator[](unsigned) const;
+
+    inline bool equals(const char*) const;
+    inline bool iequals(const char*) const;
+    inline bool beginswith(const char*) const;
+    inline bool ibeginswith(const char*) const;
+    inline bool endswith(const char*) const;
+    inline bool iendswith(const char*) const;
+
+    template<unsigned limit = 0> inline string_view ltrim(const char *key = " ") const;
+    template<unsigned limit = 0> inline string_view rtrim(const char *key = " ") const;
+    template<unsigned limit = 0> inline string_view trim(const char *key = " ", const char *rkey = 0) const;
+
+    inline bool operator==(const char*) const;
+    inline bool operator!=(const char*) const;
+
+    inline string_view();
+    inline string_view(const char*);
+    inline string_view(const char*, unsigned);
+    inline string_view(const string&);
+  };
+
+  //a wildcard pattern prepared once, for matching many strings against it.
+  //patterns of literal runs separated by '*' are matched by anchoring the first and
+  //last run and searching for the ones between; patterns using '?' fall back to wildcard().
+  struct wildcard_pattern {
+    inline bool match(const char*) const;
+    inline wildcard_pattern(const char *pattern, bool insensitive = false);
+
+  private:
+    struct segment { unsigned offset, length; };
+    string text;
+    linear_vector<segment> segments;
+    unsigned minimum;  //combined length of the literal runs
+    bool insensitive, general, star, anchor_begin, anchor_end;
+
+    inline bool equal(const char*, const segment&) const;
+  };
+
+  //iterates over the fields lstring::split would produce, as views into the source
+  struct split_view {
+    struct iterator {
+      inline string_view operator*() const;
+      inline iterator& operator++();
+      inline bool operator!=(const iterator&) const;
+      inline iterator(const split_view*, bool);
+    private:
+      const split_view *parent;
+      const char *next;  //start of the next field, or 0 after the last one
+      string_view field;
+      bool valid;
+    };
+
+    inline iterator begin() const;
+    inline iterator end() const;
+
+    inline split_view(const string_view &text, const char *key);
+
+  private:
+    string_view text;
+    const char *key;
+    unsigned keysize;
+  };
+
   //compare.hpp
   inline char chrlower(char c);
   inline char chrupper(char c);
@@ -137,6 +224,12 @@ namespace nall {
   inline bool strint(const char *str, int &result);
   inline bool strmath(const char *str, int &result);
 
+  //number.hpp
+  inline unsigned format_decimal(char *output, uintmax_t value);
+  inline unsigned format_integer(char *output, intmax_t value);
+  inline unsigned format_hex(char *output, uintmax_t value);
+  inline unsigned format_fp(char *output, double value);
+
   //platform.hpp
   inline string realpath(const char *name);
   inline string userpath();
@@ -152,6 +245,7 @@ namespace nall {
   inline optional<unsigned> qstrpos(const char *str, const char *key);
   inline optional<unsigned> iqstrpos(const char *str, const char *key);
   template<bool Insensitive = false, bool Quoted = false> inline optional<unsigned> ustrpos(const char *str, const char *key);
+  template<bool Insensitive> inline const char* ustrsearch(const char *str, unsigned length, const char *key, unsigned keylength);
 
   //trim.hpp
   template<unsigned limit = 0> inline char* ltrim(char *str, const char *key = " ");
@@ -59,6 +59,69 @@ bool iwildcard(const char *s, const char *p) {
   return !*p;
 }
 
+bool wildcard_pattern::match(const char *str) const {
+  if(general) return insensitive ? iwildcard(str, text) : wildcard(str, text);
+
+  unsigned length = strlen(str);
+  if(length < minimum) return false;
+  if(!star) return length == minimum && (segments.size() == 0 || equal(str, segments[0]));
+
+  const char *begin = str, *end = str + length;
+  unsigned first = 0, last = segments.size();
+  if(anchor_begin) {
+    if(!equal(begin, segments[first])) return false;
+    begin += segments[first++].length;
+  }
+  if(anchor_end) {
+    end -= segments[--last].length;
+    if(!equal(end, segments[last])) return false;
+  }
+
+  //leftmost matches of the runs in between leave the most room for those after them
+  for(unsigned n = first; n < last; n++) {
+    const char *key = (const char*)text + segments[n].offset;
+    const char *p = insensitive
+    ? ustrsearch<true>(begin, end - begin, key, segments[n].length)
+    : ustrsearch<false>(begin, end - begin, key, segments[n].length);
+    if(!p) return false;
+    begin = p + segments[n].length;
+  }
+  return true;
+}
+
+bool wildcard_pattern::equal(const char *str, const segment &run) const {
+  const char *key = (const char*)text + run.offset;
+  if(!insensitive) return !memcmp(str, key, run.length);
+  for(unsigned n = 0; n < run.length; n++) {
+    if(!chrequal<true>(str[n], key[n])) return false;
+  }
+  return true;
+}
+
+wildcard_pattern::wildcard_pattern(const char *pattern, bool insensitive)
+: text(pattern), minimum(0), insensitive(insensitive), general(false), star(false) {
+  const char *p = text;
+  anchor_begin = *p != '*';
+  anchor_end = *p && p[strlen(p) - 1] != '*';
+
+  for(unsigned offset = 0; p[offset];) {
+    if(p[offset] == '?') general = true;
+    if(p[offset] == '*') {
+      star = true;
+      offset++;
+      continue;
+    }
+    unsigned length = 0;
+    while(p[offset + length] && p[offset + length] != '*') {
+      if(p[offset + length] == '?') general = true;
+      length++;
+    }
+    segments.append({offset, length});
+    minimum += length;
+    offset += length;
+  }
+}
+
 bool strbegin(const char *str, const char *key) {
   int i, ssl = strlen(str), ksl = strlen(key);
 
@@ -60,6 +60,9 @@ char* strtr(char *dest, const char *before, const char *after) {
   return dest;
 }
 
+//decimal digits are tested with one unsigned comparison each, as characters below '0'
+//wrap around; hex digits are looked up in a table.
+
 uintmax_t hex(const char *str) {
   if(!str) return 0;
   uintmax_t result = 0;
@@ -68,12 +71,21 @@ uintmax_t hex(const char *str) {
   if(*str == '0' && (*(str + 1) == 'X' || *(str + 1) == 'x')) str += 2;
   else if(*str == '$') str++;
 
-  while(*str) {
-    uint8_t x = *str++;
-    if(x >= '0' && x <= '9') x -= '0';
-    else if(x >= 'A' && x <= 'F') x -= 'A' - 10;
-    else if(x >= 'a' && x <= 'f') x -= 'a' - 10;
-    else break;  //stop at first invalid character
+  //digit values by character, 16 for anything that is not a hex digit
+  static const uint8_t value[256] = {
+    16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16, 16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,
+    16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,  0, 1, 2, 3, 4, 5, 6, 7, 8, 9,16,16,16,16,16,16,
+    16,10,11,12,13,14,15,16,16,16,16,16,16,16,16,16, 16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,
+    16,10,11,12,13,14,15,16,16,16,16,16,16,16,16,16, 16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,
+    16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16, 16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,
+    16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16, 16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,
+    16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16, 16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,
+    16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16, 16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,
+  };
+
+  while(true) {
+    unsigned x = value[(uint8_t)*str++];
+    if(x >= 16) break;  //stop at first invalid character
     result = result * 16 + x;
   }
 
@@ -82,25 +94,17 @@ uintmax_t hex(const char *str) {
 
 intmax_t integer(const char *str) {
   if(!str) return 0;
-  intmax_t result = 0;
   bool negate = false;
 
   //check for sign
   if(*str == '+') {
-    negate = false;
     str++;
   } else if(*str == '-') {
     negate = true;
     str++;
   }
 
-  while(*str) {
-    uint8_t x = *str++;
-    if(x >= '0' && x <= '9') x -= '0';
-    else break;  //stop at first invalid character
-    result = result * 10 + x;
-  }
-
+  uintmax_t result = decimal(str);
   return !negate ? result : -result;
 }
 
@@ -108,10 +112,9 @@ uintmax_t decimal(const char *str) {
   if(!str) return 0;
   uintmax_t result = 0;
 
-  while(*str) {
-    uint8_t x = *str++;
-    if(x >= '0' && x <= '9') x -= '0';
-    else break;  //stop at first invalid character
+  while(true) {
+    unsigned x = (uint8_t)*str++ - '0';
+    if(x >= 10) break;  //stop at first invalid character
     result = result * 10 + x;
   }
 
@@ -126,18 +129,63 @@ uintmax_t binary(const char *str) {
   if(*str == '0' && (*(str + 1) == 'B' || *(str + 1) == 'b')) str += 2;
   else if(*str == '%') str++;
 
-  while(*str) {
-    uint8_t x = *str++;
-    if(x == '0' || x == '1') x -= '0';
-    else break;  //stop at first invalid character
+  while(true) {
+    unsigned x = (uint8_t)*str++ - '0';
+    if(x >= 2) break;  //stop at first invalid character
     result = result * 2 + x;
   }
 
   return result;
 }
 
+//decimal numbers of up to 19 significant digits that fit in 53 bits, scaled by at most
+//10^22, are read exactly with a single multiplication or division (Clinger's fast path).
+//everything else, including hex floats, inf and nan, is left to strtod.
 double fp(const char *str) {
-  return atof(str);
+  if(!str) return 0.0;
+  #if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+  static const double power[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+
+  const char *p = str;
+  while(*p == ' ' || (unsigned)(*p - '\t') < 5) p++;
+  bool negate = *p == '-';
+  if(*p == '-' || *p == '+') p++;
+
+  uint64_t mantissa = 0;
+  unsigned digits = 0, significant = 0;
+  signed exponent = 0;
+  for(unsigned x; (x = (uint8_t)*p - '0') < 10; p++, digits++) {
+    mantissa = mantissa * 10 + x;
+    if(mantissa) significant++;
+  }
+  if(*p == '.') {
+    for(unsigned x; (x = (uint8_t)*++p - '0') < 10; digits++, exponent--) {
+      mantissa = mantissa * 10 + x;
+      if(mantissa) significant++;
+    }
+  }
+
+  if(digits && significant <= 19 && (*p | 0x20) != 'x') {
+    if((*p | 0x20) == 'e') {
+      const char *e = p + 1;
+      bool negative = *e == '-';
+      if(*e == '-' || *e == '+') e++;
+      signed value = 0;
+      for(unsigned x; (x = (uint8_t)*e - '0') < 10 && value < 10000; e++) value = value * 10 + x;
+      if((uint8_t)*e - '0' < 10) return strtod(str, 0);
+      exponent += negative ? -value : value;
+    }
+    if(mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+      double result = mantissa;
+      result = exponent < 0 ? result / power[-exponent] : result * power[exponent];
+      return negate ? -result : result;
+    }
+  }
+  #endif
+  return strtod(str, 0);
 }
 
 }
@@ -12,16 +12,44 @@ static void istring(string &output, const T &value, Args&&... args) {
   istring(output, std::forward<Args>(args)...);
 }
 
+//strings already know their length, and are appended without a temporary copy
+template<typename... Args>
+static void istring(string &output, const string &value, Args&&... args) {
+  output.append_(value, value.length());
+  istring(output, std::forward<Args>(args)...);
+}
+
+template<typename... Args>
+static void istring(string &output, const string_view &value, Args&&... args) {
+  output.append_(value.data, value.size);
+  istring(output, std::forward<Args>(args)...);
+}
+
+char* string::data() {
+  return size > inline_size ? pointer : buffer;
+}
+
+const char* string::data() const {
+  return size > inline_size ? pointer : buffer;
+}
+
 void string::reserve(unsigned size_) {
   if(size_ > size) {
+    if(size > inline_size) {
+      pointer = (char*)realloc(pointer, size_ + 1);
+    } else {
+      char *heap = (char*)malloc(size_ + 1);
+      memcpy(heap, buffer, inline_size + 1);
+      pointer = heap;
+    }
     size = size_;
-    data = (char*)realloc(data, size + 1);
-    data[size] = 0;
+    pointer[size] = 0;
   }
 }
 
 template<typename... Args> string& string::assign(Args&&... args) {
-  *data = 0;
+  *data() = 0;
+  used = 0;
   istring(*this, std::forward<Args>(args)...);
   return *this;
 }
@@ -34,71 +62,103 @@ template<typename... Args> string& string::append(Args&&... args) {
 string& string::assign_(const char *s) {
   unsigned length = strlen(s);
   reserve(length);
-  strcpy(data, s);
+  memmove(data(), s, length + 1);
+  used = length;
   return *this;
 }
 
 string& string::append_(const char *s) {
-  unsigned length = strlen(data) + strlen(s);
-  reserve(length);
-  strcat(data, s);
+  return append_(s, strlen(s));
+}
+
+//capacity grows geometrically, so repeated appends take amortized linear time.
+//s may point into this string (eg a.append(a)); reserve() can move or free those
+//characters, so s is found again from its offset afterward.
+string& string::append_(const char *s, unsigned length) {
+  unsigned offset = string::length();
+  if(offset + length > size) {
+    const char *base = data();
+    bool aliased = s >= base && s <= base + size;
+    unsigned position = aliased ? s - base : 0;
+    reserve(max(offset + length, size << 1));
+    if(aliased) s = data() + position;
+  }
+  char *p = data() + offset;
+  memcpy(p, s, length);
+  p[length] = 0;
+  used = offset + length;
   return *this;
 }
 
 string::operator const char*() const {
-  return data;
+  return data();
 }
 
 char* string::operator()() {
-  return data;
+  used = ~0u;
+  return data();
 }
 
 char& string::operator[](int index) {
   reserve(index);
-  return data[index];
+  used = ~0u;
+  return data()[index];
 }
 
-bool string::operator==(const char *str) const { return strcmp(data, str) == 0; }
-bool string::operator!=(const char *str) const { return strcmp(data, str) != 0; }
-bool string::operator< (const char *str) const { return strcmp(data, str)  < 0; }
-bool string::operator<=(const char *str) const { return strcmp(data, str) <= 0; }
-bool string::operator> (const char *str) const { return strcmp(data, str)  > 0; }
-bool string::operator>=(const char *str) const { return strcmp(data, str) >= 0; }
+bool string::operator==(const char *str) const { return strcmp(data(), str) == 0; }
+bool string::operator!=(const char *str) const { return strcmp(data(), str) != 0; }
+bool string::operator< (const char *str) const { return strcmp(data(), str)  < 0; }
+bool string::operator<=(const char *str) const { return strcmp(data(), str) <= 0; }
+bool string::operator> (const char *str) const { return strcmp(data(), str)  > 0; }
+bool string::operator>=(const char *str) const { return strcmp(data(), str) >= 0; }
 
 string& string::operator=(const string &value) {
-  assign(value);
+  if(this == &value) return *this;
+  unsigned length = value.length();
+  reserve(length);
+  memcpy(data(), value.data(), length + 1);
+  used = length;
   return *this;
 }
 
 string& string::operator=(string &&source) {
-  if(data) free(data);
+  if(this == &source) return *this;
+  if(size > inline_size) free(pointer);
+  memcpy(buffer, source.buffer, inline_size + 1);
   size = source.size;
-  data = source.data;
-  source.data = 0;
-  source.size = 0;
+  used = source.used;
+  source.size = inline_size;
+  source.used = 0;
+  *source.buffer = 0;
   return *this;
 }
 
 template<typename... Args> string::string(Args&&... args) {
-  size = 64;
-  data = (char*)malloc(size + 1);
-  *data = 0;
+  size = inline_size;
+  used = 0;
+  *buffer = 0;
   istring(*this, std::forward<Args>(args)...);
 }
 
 string::string(const string &value) {
-  size = strlen(value);
-  data = strdup(value);
+  unsigned length = value.length();
+  size = max(length, (unsigned)inline_size);
+  if(size > inline_size) pointer = (char*)malloc(size + 1);
+  memcpy(data(), value.data(), length + 1);
+  used = length;
 }
 
 string::string(string &&source) {
+  memcpy(buffer, source.buffer, inline_size + 1);
   size = source.size;
-  data = source.data;
-  source.data = 0;
+  used = source.used;
+  source.size = inline_size;
+  source.used = 0;
+  *source.buffer = 0;
 }
 
 string::~string() {
-  if(data) free(data);
+  if(size > inline_size) free(pointer);
 }
 
 bool string::readfile(const string &filename) {
@@ -114,12 +174,11 @@ bool string::readfile(const string &filename) {
   fseek(fp, 0, SEEK_END);
   unsigned size = ftell(fp);
   rewind(fp);
-  char *fdata = new char[size + 1];
-  unsigned unused = fread(fdata, 1, size, fp);
+  reserve(size);
+  unsigned length = fread(data(), 1, size, fp);
   fclose(fp);
-  fdata[size] = 0;
-  assign(fdata);
-  delete[] fdata;
+  data()[length] = 0;
+  used = ~0u;  //the file may contain null bytes
 
   return true;
 }
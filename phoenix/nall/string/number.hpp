@@ -0,0 +1,259 @@
+#ifndef NALL_STRING_NUMBER_HPP
+#define NALL_STRING_NUMBER_HPP
+
+//number <> text conversion shared by string construction, the config file and http.
+//integers are written two digits at a time from a table of all pairs, and read with
+//one comparison per digit. doubles are written with Grisu2 (Florian Loitsch, 2010):
+//the shortest digits that read back as the same double (the shortest in nearly all
+//cases, and always exact), without going through printf. doubles are read exactly
+//with one multiplication or division when the digits fit in 53 bits and the power
+//of ten is at most 22; anything else is left to strtod.
+
+namespace nall {
+
+static const char number_digit_pairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const uint64_t number_pow10[20] = {
+  1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+  1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+  100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+  1000000000000000000ull, 10000000000000000000ull,
+};
+
+unsigned format_decimal(char *output, uintmax_t value) {
+  char buffer[24];
+  char *p = buffer + sizeof buffer;
+  while(value >= 100) {
+    unsigned n = value % 100;
+    value /= 100;
+    p -= 2;
+    memcpy(p, number_digit_pairs + n * 2, 2);
+  }
+  if(value >= 10) {
+    p -= 2;
+    memcpy(p, number_digit_pairs + value * 2, 2);
+  } else {
+    *--p = '0' + value;
+  }
+  unsigned length = buffer + sizeof buffer - p;
+  memcpy(output, p, length);
+  output[length] = 0;
+  return length;
+}
+
+//the sign is always written, as nall prints signed values
+unsigned format_integer(char *output, intmax_t value) {
+  output[0] = value < 0 ? '-' : '+';
+  return 1 + format_decimal(output + 1, value < 0 ? -(uintmax_t)value : (uintmax_t)value);
+}
+
+unsigned format_hex(char *output, uintmax_t value) {
+  char buffer[16];
+  char *p = buffer + sizeof buffer;
+  do {
+    *--p = "0123456789abcdef"[value & 15];
+    value >>= 4;
+  } while(value);
+  unsigned length = buffer + sizeof buffer - p;
+  memcpy(output, p, length);
+  output[length] = 0;
+  return length;
+}
+
+//a double as f * 2^e, with a full 64-bit significand
+struct number_diyfp {
+  uint64_t f;
+  signed e;
+
+  number_diyfp operator-(const number_diyfp &source) const { return {f - source.f, e}; }
+
+  //the upper 64 bits of the 128-bit product, rounded
+  number_diyfp operator*(const number_diyfp &source) const {
+    uint64_t a = f >> 32, b = f & 0xffffffff, c = source.f >> 32, d = source.f & 0xffffffff;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff) + (1u << 31);
+    return {ac + (ad >> 32) + (bc >> 32) + (middle >> 32), e + source.e + 64};
+  }
+
+  number_diyfp normalize() const {
+    unsigned shift = __builtin_clzll(f);
+    return {f << shift, e - (signed)shift};
+  }
+};
+
+//10^k as a normalized number_diyfp, for k = -348 + 8 * index
+inline number_diyfp number_cached_power(unsigned index) {
+  static const uint64_t significand[87] = {
+    0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull, 0xcf42894a5dce35eaull,
+    0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull, 0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full,
+    0xbe5691ef416bd60cull, 0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+    0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull, 0xc21094364dfb5637ull,
+    0x9096ea6f3848984full, 0xd77485cb25823ac7ull, 0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull,
+    0xb23867fb2a35b28eull, 0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+    0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull, 0xb5b5ada8aaff80b8ull,
+    0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull, 0x964e858c91ba2655ull, 0xdff9772470297ebdull,
+    0xa6dfbd9fb8e5b88full, 0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+    0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull, 0xaa242499697392d3ull,
+    0xfd87b5f28300ca0eull, 0xbce5086492111aebull, 0x8cbccc096f5088ccull, 0xd1b71758e219652cull,
+    0x9c40000000000000ull, 0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+    0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull, 0x9f4f2726179a2245ull,
+    0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull, 0x83c7088e1aab65dbull, 0xc45d1df942711d9aull,
+    0x924d692ca61be758ull, 0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+    0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull, 0x952ab45cfa97a0b3ull,
+    0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull, 0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull,
+    0x88fcf317f22241e2ull, 0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+    0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull, 0x8bab8eefb6409c1aull,
+    0xd01fef10a657842cull, 0x9b10a4e5e9913129ull, 0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull,
+    0x80444b5e7aa7cf85ull, 0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+    0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull
+  };
+  static const int16_t exponent[87] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066
+  };
+  return {significand[index], exponent[index]};
+}
+
+//steps the last digit down while that brings it closer to the exact value
+inline void number_grisu_round(char *buffer, unsigned length, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t distance) {
+  while(rest < distance && delta - rest >= tenKappa
+  && (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+    buffer[length - 1]--;
+    rest += tenKappa;
+  }
+}
+
+//writes the digits of a double to buffer (no sign, point or exponent), and returns
+//their count; the value is digits * 10^exponent
+inline unsigned number_grisu(double value, char *buffer, signed &exponent) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof bits);
+  signed biased = (bits >> 52) & 0x7ff;
+  uint64_t fraction = bits & 0x000fffffffffffffull;
+  number_diyfp v = biased ? number_diyfp{fraction | 0x0010000000000000ull, biased - 1075} : number_diyfp{fraction, -1074};
+
+  //the boundaries halfway to the neighbouring doubles
+  number_diyfp plus = number_diyfp{(v.f << 1) + 1, v.e - 1}.normalize();
+  number_diyfp minus = v.f == 0x0010000000000000ull ? number_diyfp{(v.f << 2) - 1, v.e - 2} : number_diyfp{(v.f << 1) - 1, v.e - 1};
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  //scale by a cached power of ten, so that the binary exponent lands in [-60, -32]
+  double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+  signed k = (signed)dk;
+  if(dk - k > 0.0) k++;
+  unsigned index = (k >> 3) + 1;
+  exponent = -(-348 + (signed)(index << 3));
+  number_diyfp power = number_cached_power(index);
+
+  number_diyfp w = v.normalize() * power;
+  number_diyfp high = plus * power, low = minus * power;
+  low.f++;
+  high.f--;
+
+  uint64_t delta = high.f - low.f;
+  number_diyfp one = {1ull << -high.e, high.e};
+  uint64_t distance = (high - w).f;
+  uint32_t integral = high.f >> -one.e;
+  uint64_t rest = high.f & (one.f - 1);
+
+  unsigned length = 0;
+  signed kappa = 1;
+  while(kappa < 10 && integral >= number_pow10[kappa]) kappa++;
+
+  while(kappa > 0) {
+    uint32_t divisor = number_pow10[kappa - 1];
+    uint32_t digit = integral / divisor;
+    integral %= divisor;
+    if(digit || length) buffer[length++] = '0' + digit;
+    kappa--;
+    uint64_t remainder = ((uint64_t)integral << -one.e) + rest;
+    if(remainder <= delta) {
+      exponent += kappa;
+      number_grisu_round(buffer, length, delta, remainder, number_pow10[kappa] << -one.e, distance);
+      return length;
+    }
+  }
+
+  while(true) {
+    rest *= 10;
+    delta *= 10;
+    char digit = rest >> -one.e;
+    if(digit || length) buffer[length++] = '0' + digit;
+    rest &= one.f - 1;
+    kappa--;
+    if(rest < delta) {
+      exponent += kappa;
+      number_grisu_round(buffer, length, delta, rest, one.f, distance * (-kappa < 20 ? number_pow10[-kappa] : 0));
+      return length;
+    }
+  }
+}
+
+//output must hold 32 bytes. values from 1e-5 up to 1e21 are written without an
+//exponent, and whole numbers keep a trailing ".0", as fp() always did.
+unsigned format_fp(char *output, double value) {
+  char *p = output;
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof bits);
+  if(bits >> 63) *p++ = '-';
+  if(((bits >> 52) & 0x7ff) == 0x7ff) {
+    memcpy(p, bits & 0x000fffffffffffffull ? "nan" : "inf", 4);
+    return p + 3 - output;
+  }
+  if((bits << 1) == 0) {
+    memcpy(p, "0.0", 4);
+    return p + 3 - output;
+  }
+
+  char digits[24];
+  signed exponent;
+  signed length = number_grisu(bits >> 63 ? -value : value, digits, exponent);
+  signed point = length + exponent;  //digits before the decimal point
+
+  if(exponent >= 0 && point <= 21) {
+    //1234e7 -> 12340000000.0
+    memcpy(p, digits, length);
+    memset(p + length, '0', exponent);
+    p += point;
+    memcpy(p, ".0", 2);
+    p += 2;
+  } else if(point > 0 && point <= 21) {
+    //1234e-2 -> 12.34
+    memcpy(p, digits, point);
+    p[point] = '.';
+    memcpy(p + point + 1, digits + point, length - point);
+    p += length + 1;
+  } else if(point > -5 && point <= 0) {
+    //1234e-6 -> 0.001234
+    memcpy(p, "0.", 2);
+    memset(p + 2, '0', -point);
+    memcpy(p + 2 - point, digits, length);
+    p += 2 - point + length;
+  } else {
+    //1234e30 -> 1.234e33
+    *p++ = digits[0];
+    if(length > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, length - 1);
+      p += length - 1;
+    }
+    *p++ = 'e';
+    p += format_integer(p, point - 1);
+  }
+  *p = 0;
+  return p - output;
+}
+
+}
+
+#endif
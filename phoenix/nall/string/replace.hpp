@@ -3,42 +3,106 @@
 
 namespace nall {
 
+//finds the next match of key in [p, end), stepping over quoted runs when Quoted.
+//unquoted searches use ustrsearch; quoted ones skip ahead with a table of the bytes
+//that can start a match or a quoted run.
+template<bool Insensitive, bool Quoted> struct ureplace_finder {
+  const char* operator()(const char *p, const char *end) const {
+    if(Quoted == false) return ustrsearch<Insensitive>(p, end - p, key, keyLength);
+
+    while(end - p >= keyLength) {
+      while(p < end && !stop[(uint8_t)*p]) p++;
+      if(end - p < keyLength) return 0;
+
+      if(*p == '\'' || *p == '\"') {
+        const char *close = (const char*)memchr(p + 1, *p, end - p - 1);
+        p = close ? close + 1 : end;
+        continue;
+      }
+
+      if(equal(p)) return p;
+      p++;
+    }
+    return 0;
+  }
+
+  ureplace_finder(const char *key, unsigned keyLength) : key(key), keyLength(keyLength) {
+    if(Quoted == false) return;
+    memset(stop, 0, sizeof stop);
+    stop[(uint8_t)key[0]] = true;
+    if(Insensitive) stop[(uint8_t)chrlower(key[0])] = stop[(uint8_t)chrupper(key[0])] = true;
+    stop[(uint8_t)'\''] = stop[(uint8_t)'\"'] = true;
+  }
+
+private:
+  const char *key;
+  signed keyLength;
+  bool stop[256];
+
+  bool equal(const char *p) const {
+    if(Insensitive == false) return !memcmp(p, key, keyLength);
+    for(signed n = 0; n < keyLength; n++) {
+      if(!chrequal<true>(key[n], p[n])) return false;
+    }
+    return true;
+  }
+};
+
+//the string is rewritten in place in a single pass when the token is not longer than
+//the key. otherwise match offsets are recorded, the string is grown once to its final
+//length, and rebuilt from the back.
 template<unsigned Limit, bool Insensitive, bool Quoted>
 string& string::ureplace(const char *key, const char *token) {
   if(!key || !*key) return *this;
   enum : unsigned { limit = Limit ? Limit : ~0u };
 
-  const char *p = data;
-  unsigned counter = 0, keyLength = 0;
+  unsigned keyLength = strlen(key), tokenLength = strlen(token), length = string::length();
+  ureplace_finder<Insensitive, Quoted> find(key, keyLength);
+  char *base = data();
+  const char *end = base + length, *p = base, *match;
+  unsigned counter = 0;
 
-  while(*p) {
-    if(quoteskip<Quoted>(p)) continue;
-    for(unsigned n = 0;; n++) {
-      if(key[n] == 0) { counter++; p += n; keyLength = n; break; }
-      if(!chrequal<Insensitive>(key[n], p[n])) { p++; break; }
+  if(tokenLength <= keyLength) {
+    char *o = base;
+    while(counter < limit && (match = find(p, end))) {
+      memmove(o, p, match - p);
+      o += match - p;
+      memcpy(o, token, tokenLength);
+      o += tokenLength;
+      p = match + keyLength;
+      counter++;
     }
+    if(counter == 0) return *this;
+    memmove(o, p, end - p);
+    o += end - p;
+    *o = 0;
+    used = o - base;
+    return *this;
   }
-  if(counter == 0) return *this;
-  if(Limit) counter = min(counter, Limit);
 
-  char *t = data, *base;
-  unsigned tokenLength = strlen(token);
-  if(tokenLength > keyLength) {
-    t = base = strdup(data);
-    reserve((unsigned)(p - data) + ((tokenLength - keyLength) * counter));
+  linear_vector<unsigned> offsets;
+  while(counter < limit && (match = find(p, end))) {
+    offsets.append(match - base);
+    p = match + keyLength;
+    counter++;
   }
-  char *o = data;
+  if(counter == 0) return *this;
 
-  while(*t && counter) {
-    if(quotecopy<Quoted>(o, t)) continue;
-    for(unsigned n = 0;; n++) {
-      if(key[n] == 0) { counter--; memcpy(o, token, tokenLength); t += keyLength; o += tokenLength; break; }
-      if(!chrequal<Insensitive>(key[n], t[n])) { *o++ = *t++; break; }
-    }
+  unsigned total = length + (tokenLength - keyLength) * counter;
+  reserve(total);
+  base = data();
+  char *o = base + total;
+  const char *tail = base + length;
+  *o = 0;
+  while(counter--) {
+    const char *next = base + offsets[counter] + keyLength;
+    o -= tail - next;
+    memmove(o, next, tail - next);
+    o -= tokenLength;
+    memcpy(o, token, tokenLength);
+    tail = base + offsets[counter];
   }
-  do *o++ = *t; while(*t++);
-  if(tokenLength > keyLength) free(base);
-
+  used = total;
   return *this;
 }
 
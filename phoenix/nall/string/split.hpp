@@ -3,9 +3,13 @@
 
 namespace nall {
 
+//existing elements are assigned in place, so splitting into a reused list keeps
+//their storage instead of allocating every field again
 template<unsigned Limit, bool Insensitive, bool Quoted> lstring& lstring::usplit(const char *key, const char *base) {
-  reset();
-  if(!key || !*key) return *this;
+  if(!key || !*key) {
+    reset();
+    return *this;
+  }
 
   const char *p = base;
   unsigned counter = 0;
@@ -15,7 +19,7 @@ template<unsigned Limit, bool Insensitive, bool Quoted> lstring& lstring::usplit
     if(quoteskip<Quoted>(p)) continue;
     for(unsigned n = 0;; n++) {
       if(key[n] == 0) {
-        strlcpy(operator[](counter++), base, (unsigned)(p - base + 1));
+        operator[](counter++).assign(string_view(base, p - base));
         p += n;
         base = p;
         break;
@@ -24,7 +28,8 @@ template<unsigned Limit, bool Insensitive, bool Quoted> lstring& lstring::usplit
     }
   }
 
-  operator[](counter) = base;
+  operator[](counter).assign(base);
+  resize(counter + 1);
   return *this;
 }
 
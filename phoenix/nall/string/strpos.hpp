@@ -7,10 +7,112 @@
 
 namespace nall {
 
+//substring search over a buffer of known length.
+//a block of candidate positions is tested against the first and last byte of key at
+//once, and only positions matching both are compared in full. case-insensitive search
+//folds letters by setting bit 5, which maps 'A'-'Z' onto 'a'-'z' and nothing else onto them.
+template<bool Insensitive> struct ustrsearch_engine {
+  typedef const char* (*search_t)(const char*, unsigned, const char*, unsigned);
+
+  static uint8_t fold(char c) {
+    return Insensitive && (c | 0x20) >= 'a' && (c | 0x20) <= 'z' ? 0x20 : 0x00;
+  }
+
+  static bool equal(const char *str, const char *key, unsigned length) {
+    if(Insensitive == false) return !memcmp(str, key, length);
+    for(unsigned n = 0; n < length; n++) {
+      if(!chrequal<true>(str[n], key[n])) return false;
+    }
+    return true;
+  }
+
+  static const char* search_scalar(const char *str, unsigned length, const char *key, unsigned keylength) {
+    if(length < keylength) return 0;
+    const char *last = str + length - keylength;
+    if(Insensitive == false) {
+      while(str <= last) {
+        str = (const char*)memchr(str, key[0], last - str + 1);
+        if(!str) return 0;
+        if(!memcmp(str + 1, key + 1, keylength - 1)) return str;
+        str++;
+      }
+      return 0;
+    }
+    for(; str <= last; str++) {
+      if(equal(str, key, keylength)) return str;
+    }
+    return 0;
+  }
+
+  #if defined(NALL_CPUID_X86)
+  __attribute__((target("sse2")))
+  static const char* search_sse2(const char *str, unsigned length, const char *key, unsigned keylength) {
+    unsigned last = keylength - 1, offset = 0;
+    __m128i firstFold = _mm_set1_epi8(fold(key[0])), firstByte = _mm_set1_epi8(key[0] | fold(key[0]));
+    __m128i lastFold = _mm_set1_epi8(fold(key[last])), lastByte = _mm_set1_epi8(key[last] | fold(key[last]));
+    while(offset + last + 16 <= length) {
+      __m128i x = _mm_or_si128(_mm_loadu_si128((const __m128i*)(str + offset)), firstFold);
+      __m128i y = _mm_or_si128(_mm_loadu_si128((const __m128i*)(str + offset + last)), lastFold);
+      unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, firstByte), _mm_cmpeq_epi8(y, lastByte)));
+      while(mask) {
+        const char *p = str + offset + __builtin_ctz(mask);
+        if(keylength < 3 || equal(p + 1, key + 1, keylength - 2)) return p;
+        mask &= mask - 1;
+      }
+      offset += 16;
+    }
+    return search_scalar(str + offset, length - offset, key, keylength);
+  }
+
+  __attribute__((target("avx2")))
+  static const char* search_avx2(const char *str, unsigned length, const char *key, unsigned keylength) {
+    unsigned last = keylength - 1, offset = 0;
+    __m256i firstFold = _mm256_set1_epi8(fold(key[0])), firstByte = _mm256_set1_epi8(key[0] | fold(key[0]));
+    __m256i lastFold = _mm256_set1_epi8(fold(key[last])), lastByte = _mm256_set1_epi8(key[last] | fold(key[last]));
+    while(offset + last + 32 <= length) {
+      __m256i x = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(str + offset)), firstFold);
+      __m256i y = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(str + offset + last)), lastFold);
+      unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x, firstByte), _mm256_cmpeq_epi8(y, lastByte)));
+      while(mask) {
+        const char *p = str + offset + __builtin_ctz(mask);
+        if(keylength < 3 || equal(p + 1, key + 1, keylength - 2)) return p;
+        mask &= mask - 1;
+      }
+      offset += 32;
+    }
+    return search_sse2(str + offset, length - offset, key, keylength);
+  }
+  #endif
+
+  static search_t select() {
+    #if defined(NALL_CPUID_X86)
+    if(cpuid::supports(cpuid::avx2)) return search_avx2;
+    if(cpuid::supports(cpuid::sse2)) return search_sse2;
+    #endif
+    return search_scalar;
+  }
+};
+
+//returns the first occurrence of key in [str, str + length), or 0
+template<bool Insensitive>
+const char* ustrsearch(const char *str, unsigned length, const char *key, unsigned keylength) {
+  static typename ustrsearch_engine<Insensitive>::search_t search = ustrsearch_engine<Insensitive>::select();
+  if(keylength == 0) return str;
+  if(length < keylength) return 0;
+  return search(str, length, key, keylength);
+}
+
 template<bool Insensitive, bool Quoted>
 optional<unsigned> ustrpos(const char *str, const char *key) {
   const char *base = str;
 
+  if(Quoted == false) {
+    if(*str == 0) return { false, 0 };
+    const char *match = ustrsearch<Insensitive>(str, strlen(str), key, strlen(key));
+    if(match) return { true, (unsigned)(match - base) };
+    return { false, 0 };
+  }
+
   while(*str) {
     if(quoteskip<Quoted>(str)) continue;
     for(unsigned n = 0;; n++) {
@@ -72,123 +72,71 @@ string sha256(const uint8_t *data, unsigned size) {
 /* arithmetic <> string */
 
 template<unsigned length_, char padding> string integer(intmax_t value) {
-  bool negative = value < 0;
-  if(negative) value = abs(value);
-
-  char buffer[64];
-  unsigned size = 0;
-
-  do {
-    unsigned n = value % 10;
-    buffer[size++] = '0' + n;
-    value /= 10;
-  } while(value);
-  buffer[size++] = negative ? '-' : '+';
-  buffer[size] = 0;
+  char buffer[32];
+  unsigned size = format_integer(buffer, value);
 
   unsigned length = (length_ == 0 ? size : length_);
+  unsigned copy = (size < length ? size : length);
   char result[length + 1];
   memset(result, padding, length);
   result[length] = 0;
-
-  for(signed x = length - 1, y = 0; x >= 0 && y < size; x--, y++) {
-    result[x] = buffer[y];
-  }
+  memcpy(result + length - copy, buffer + size - copy, copy);  //too long: keep the lowest digits
 
   return (const char*)result;
 }
 
 template<unsigned length_, char padding> string linteger(intmax_t value) {
-  bool negative = value < 0;
-  if(negative) value = abs(value);
-
-  char buffer[64];
-  unsigned size = 0;
-
-  do {
-    unsigned n = value % 10;
-    buffer[size++] = '0' + n;
-    value /= 10;
-  } while(value);
-  buffer[size++] = negative ? '-' : '+';
-  buffer[size] = 0;
+  char buffer[32];
+  unsigned size = format_integer(buffer, value);
 
   unsigned length = (length_ == 0 ? size : length_);
+  unsigned copy = (size < length ? size : length);
   char result[length + 1];
   memset(result, padding, length);
   result[length] = 0;
-
-  for(signed x = 0, y = size - 1; x < length && y >= 0; x++, y--) {
-    result[x] = buffer[y];
-  }
+  memcpy(result, buffer, copy);  //too long: keep the highest digits
 
   return (const char*)result;
 }
 
 template<unsigned length_, char padding> string decimal(uintmax_t value) {
-  char buffer[64];
-  unsigned size = 0;
-
-  do {
-    unsigned n = value % 10;
-    buffer[size++] = '0' + n;
-    value /= 10;
-  } while(value);
-  buffer[size] = 0;
+  char buffer[32];
+  unsigned size = format_decimal(buffer, value);
 
   unsigned length = (length_ == 0 ? size : length_);
+  unsigned copy = (size < length ? size : length);
   char result[length + 1];
   memset(result, padding, length);
   result[length] = 0;
-
-  for(signed x = length - 1, y = 0; x >= 0 && y < size; x--, y++) {
-    result[x] = buffer[y];
-  }
+  memcpy(result + length - copy, buffer + size - copy, copy);  //too long: keep the lowest digits
 
   return (const char*)result;
 }
 
 template<unsigned length_, char padding> string ldecimal(uintmax_t value) {
-  char buffer[64];
-  unsigned size = 0;
-
-  do {
-    unsigned n = value % 10;
-    buffer[size++] = '0' + n;
-    value /= 10;
-  } while(value);
-  buffer[size] = 0;
+  char buffer[32];
+  unsigned size = format_decimal(buffer, value);
 
   unsigned length = (length_ == 0 ? size : length_);
+  unsigned copy = (size < length ? size : length);
   char result[length + 1];
   memset(result, padding, length);
   result[length] = 0;
-
-  for(signed x = 0, y = size - 1; x < length && y >= 0; x++, y--) {
-    result[x] = buffer[y];
-  }
+  memcpy(result, buffer, copy);  //too long: keep the highest digits
 
   return (const char*)result;
 }
 
 template<unsigned length_, char padding> string hex(uintmax_t value) {
-  char buffer[64];
-  unsigned size = 0;
-
-  do {
-    unsigned n = value & 15;
-    buffer[size++] = n < 10 ? '0' + n : 'a' + n - 10;
-    value >>= 4;
-  } while(value);
+  char buffer[32];
+  unsigned size = format_hex(buffer, value);
 
   unsigned length = (length_ == 0 ? size : length_);
+  unsigned copy = (size < length ? size : length);
   char result[length + 1];
   memset(result, padding, length);
   result[length] = 0;
-
-  for(signed x = length - 1, y = 0; x >= 0 && y < size; x--, y++) {
-    result[x] = buffer[y];
-  }
+  memcpy(result + length - copy, buffer + size - copy, copy);  //too long: keep the lowest digits
 
   return (const char*)result;
 }
@@ -215,40 +163,54 @@ template<unsigned length_, char padding> string binary(uintmax_t value) {
   return (const char*)result;
 }
 
-//using sprintf is certainly not the most ideal method to convert
-//a double to a string ... but attempting to parse a double by
-//hand, digit-by-digit, results in subtle rounding errors.
+//writes the shortest text that reads back as the same double; see format_fp()
 unsigned fp(char *str, double value) {
-  char buffer[256];
-  sprintf(buffer, "%f", (float)value);
-
-  //remove excess 0's in fraction (2.500000 -> 2.5)
-  for(char *p = buffer; *p; p++) {
-    if(*p == '.') {
-      char *p = buffer + strlen(buffer) - 1;
-      while(*p == '0') {
-        if(*(p - 1) != '.') *p = 0;  //... but not for eg 1.0 -> 1.
-        p--;
-      }
-      break;
-    }
-  }
-
-  unsigned length = strlen(buffer);
-  if(str) strcpy(str, buffer);
+  char buffer[32];
+  unsigned length = format_fp(buffer, value);
+  if(str) memcpy(str, buffer, length + 1);
   return length + 1;
 }
 
 string fp(double value) {
-  string temp;
-  temp.reserve(fp(0, value));
-  fp(temp(), value);
-  return temp;
+  char buffer[32];
+  format_fp(buffer, value);
+  return (const char*)buffer;
 }
 
+//fixed-point, as printf("%.*f") would write it.
+//the value is scaled to a whole number and rounded to the nearest; this is only left to
+//snprintf when the value is too large to scale exactly enough, or lies too close to a tie.
 string fp(double value, unsigned precision) {
+  if(precision <= 9) {
+    double scaled = (value < 0 ? -value : value) * number_pow10[precision];
+    if(scaled < 1e12) {
+      uint64_t whole = scaled;
+      double fraction = scaled - whole;
+      if(fraction < 0.5 - 1.0 / 4096 || fraction > 0.5 + 1.0 / 4096) {
+        if(fraction > 0.5) whole++;
+        char digits[24], result[48], *p = result;
+        if(value < 0 || 1 / value < 0) *p++ = '-';
+
+        //left-pad with zeros, so there is at least one digit before the point
+        unsigned length = format_decimal(digits, whole);
+        unsigned integral = (length > precision ? length - precision : 1);
+        unsigned zeros = integral + precision - length;
+        memset(p, '0', zeros);
+        memcpy(p + zeros, digits, length);
+        p += integral;
+        if(precision) {
+          memmove(p + 1, p, precision);
+          *p = '.';
+          p += 1 + precision;
+        }
+        *p = 0;
+        return (const char*)result;
+      }
+    }
+  }
+
   char buf[256];
-  snprintf(buf, sizeof(buf), "%.*f", precision, (float)value);
+  snprintf(buf, sizeof(buf), "%.*f", precision, value);
   return buf;
 }
 
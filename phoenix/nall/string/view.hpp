@@ -0,0 +1,123 @@
+#ifndef NALL_STRING_VIEW_HPP
+#define NALL_STRING_VIEW_HPP
+
+namespace nall {
+
+unsigned string_view::length() const { return size; }
+bool string_view::empty() const { return size == 0; }
+char string_view::operator[](unsigned index) const { return data[index]; }
+
+bool string_view::equals(const char *str) const {
+  return !strncmp(data, str, size) && str[size] == 0;
+}
+
+bool string_view::iequals(const char *str) const {
+  for(unsigned n = 0; n < size; n++) {
+    if(chrlower(data[n]) != chrlower(str[n])) return false;
+  }
+  return str[size] == 0;
+}
+
+bool string_view::beginswith(const char *key) const {
+  unsigned keysize = strlen(key);
+  return keysize <= size && !memcmp(data, key, keysize);
+}
+
+bool string_view::ibeginswith(const char *key) const {
+  unsigned keysize = strlen(key);
+  return keysize <= size && string_view(data, keysize).iequals(key);
+}
+
+bool string_view::endswith(const char *key) const {
+  unsigned keysize = strlen(key);
+  return keysize <= size && !memcmp(data + size - keysize, key, keysize);
+}
+
+bool string_view::iendswith(const char *key) const {
+  unsigned keysize = strlen(key);
+  return keysize <= size && string_view(data + size - keysize, keysize).iequals(key);
+}
+
+//trimming only narrows the view; limit defaults to zero, which is equivalent to no limit
+template<unsigned Limit> string_view string_view::ltrim(const char *key) const {
+  string_view result = *this;
+  unsigned limit = Limit, keysize = key ? strlen(key) : 0;
+  if(keysize == 0) return result;
+  while(result.beginswith(key)) {
+    result.data += keysize, result.size -= keysize;
+    if(--limit == 0) break;
+  }
+  return result;
+}
+
+template<unsigned Limit> string_view string_view::rtrim(const char *key) const {
+  string_view result = *this;
+  unsigned limit = Limit, keysize = key ? strlen(key) : 0;
+  if(keysize == 0) return result;
+  while(result.endswith(key)) {
+    result.size -= keysize;
+    if(--limit == 0) break;
+  }
+  return result;
+}
+
+template<unsigned limit> string_view string_view::trim(const char *key, const char *rkey) const {
+  string_view result = rtrim<limit>(rkey ? rkey : key);
+  return result.ltrim<limit>(key);
+}
+
+bool string_view::operator==(const char *str) const { return equals(str); }
+bool string_view::operator!=(const char *str) const { return !equals(str); }
+
+string_view::string_view() : data(""), size(0) {}
+string_view::string_view(const char *data) : data(data), size(strlen(data)) {}
+string_view::string_view(const char *data, unsigned size) : data(data), size(size) {}
+string_view::string_view(const string &source) : data(source), size(source.length()) {}
+
+string_view split_view::iterator::operator*() const {
+  return field;
+}
+
+//fields end at the next occurrence of key; the text after the last one is the final field
+split_view::iterator& split_view::iterator::operator++() {
+  if(next == 0) {
+    valid = false;
+    return *this;
+  }
+
+  const char *limit = parent->text.data + parent->text.size;
+  const char *p = next;
+  while(true) {
+    p = (const char*)memchr(p, parent->key[0], limit - p);
+    if(!p || (unsigned)(limit - p) < parent->keysize) {
+      field = string_view(next, limit - next);
+      next = 0;
+      return *this;
+    }
+    if(!memcmp(p, parent->key, parent->keysize)) break;
+    p++;
+  }
+
+  field = string_view(next, p - next);
+  next = p + parent->keysize;
+  return *this;
+}
+
+bool split_view::iterator::operator!=(const iterator &source) const {
+  return valid != source.valid || next != source.next;
+}
+
+split_view::iterator::iterator(const split_view *parent, bool valid) : parent(parent), next(0), valid(valid) {
+  if(!valid) return;
+  next = parent->text.data;
+  operator++();
+}
+
+split_view::iterator split_view::begin() const { return iterator(this, keysize > 0); }
+split_view::iterator split_view::end() const { return iterator(this, false); }
+
+split_view::split_view(const string_view &text, const char *key) : text(text), key(key), keysize(key ? strlen(key) : 0) {}
+
+}
+
+#endif
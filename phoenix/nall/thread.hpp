@@ -10,6 +10,7 @@
 #else
 #include <pthread.h>
 #include <sched.h>
+#include <unistd.h>
 #include <errno.h>
 #include <iostream>
 #endif
@@ -82,6 +83,7 @@ namespace nall {
 #else
         pthread_cond_init(&cond, 0);
         pthread_mutex_init(&lock, 0);
+        signaled = false;
 #endif
       }
 
@@ -142,8 +144,10 @@ namespace nall {
   };
 
   namespace internal {
+    //deleted through this base by thread_entry
     struct callable {
       virtual void run() = 0;
+      virtual ~callable() {}
     };
 
     // We let the thread entry take ownership of the call object to avoid
@@ -182,18 +186,31 @@ namespace nall {
         start_thread(new fn_callable<decltype(obj)>(obj));
       }
 
-      thread(thread&& in_thread) { *this = std::move(in_thread); }
+      thread(thread&& in_thread) : is_running(false), is_detached(true) { *this = std::move(in_thread); }
 
       thread& operator=(thread&& in_thread) {
         detach();
         is_running = in_thread.is_running;
         is_detached = in_thread.is_detached;
+        handle = in_thread.handle;
 
         in_thread.is_running = false;
         in_thread.is_detached = true;
         return *this;
       }
 
+      // Number of processors available, for sizing worker pools.
+      static unsigned processors() {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors;
+#else
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        return count > 0 ? count : 1;
+#endif
+      }
+
       enum class priority : unsigned {
         very_low = 0,
         low,
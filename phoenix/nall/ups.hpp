@@ -1,6 +1,8 @@
 #ifndef NALL_UPS_HPP
 #define NALL_UPS_HPP
 
+#include <nall/algorithm.hpp>
+#include <nall/cpuid.hpp>
 #include <nall/crc32.hpp>
 #include <nall/file.hpp>
 #include <nall/function.hpp>
@@ -20,10 +22,13 @@ struct ups {
     patch_checksum_invalid,
     source_checksum_invalid,
     target_checksum_invalid,
+    target_unwritable,
   };
 
   function<void (unsigned offset, unsigned length)> progress;
 
+  //equal runs are skipped in bulk by comparing whole blocks, and only the bytes
+  //that differ are encoded. output is identical to a plain byte-by-byte scan.
   result create(
     const uint8_t *sourcedata, unsigned sourcelength,
     const uint8_t *targetdata, unsigned targetlength,
@@ -31,10 +36,15 @@ struct ups {
   ) {
     source_data = (uint8_t*)sourcedata, target_data = (uint8_t*)targetdata;
     source_length = sourcelength, target_length = targetlength;
-    source_offset = target_offset = 0;
-    source_checksum = target_checksum = patch_checksum = ~0;
+    patch_checksum = ~0;
 
-    if(patch_file.open(patchfilename, file::mode::write) == false) return result::patch_unwritable;
+    patch_fd = file::create(patchfilename);
+    if(patch_fd < 0) return result::patch_unwritable;
+
+    uint8_t buffer[patch_buffer_size];
+    patch_buffer = buffer;
+    patch_fill = 0;
+    patch_written = true;
 
     patch_write('U');
     patch_write('P');
@@ -43,48 +53,144 @@ struct ups {
     encode(source_length);
     encode(target_length);
 
-    unsigned output_length = source_length > target_length ? source_length : target_length;
+    static const compare_t compare = compare_select();
+    unsigned common_length = min(source_length, target_length);
+    unsigned output_length = max(source_length, target_length);
+    const uint8_t *longer = source_length > target_length ? source_data : target_data;
+
     unsigned relative = 0;
     for(unsigned offset = 0; offset < output_length;) {
-      uint8_t x = source_read();
-      uint8_t y = target_read();
-
-      if(x == y) {
-        offset++;
-        continue;
-      }
-
-      encode(offset++ - relative);
-      patch_write(x ^ y);
+      //past the end of the shorter file, its bytes read as zero
+      if(offset < common_length) offset = compare(source_data, target_data, offset, common_length);
+      if(offset >= common_length) offset = nonzero(longer, offset, output_length);
+      if(offset >= output_length) break;
 
+      encode(offset - relative);
       while(true) {
         if(offset >= output_length) {
           patch_write(0x00);
           break;
         }
 
-        x = source_read();
-        y = target_read();
+        uint8_t x = offset < source_length ? source_data[offset] : 0x00;
+        uint8_t y = offset < target_length ? target_data[offset] : 0x00;
         offset++;
         patch_write(x ^ y);
         if(x == y) break;
       }
 
       relative = offset;
+      if(progress) progress(offset, output_length);
     }
 
-    source_checksum = ~source_checksum;
-    target_checksum = ~target_checksum;
+    source_checksum = crc32_calculate(source_data, source_length);
+    target_checksum = crc32_calculate(target_data, target_length);
     for(unsigned i = 0; i < 4; i++) patch_write(source_checksum >> (i * 8));
     for(unsigned i = 0; i < 4; i++) patch_write(target_checksum >> (i * 8));
+    patch_flush();
     uint32_t patch_result_checksum = ~patch_checksum;
     for(unsigned i = 0; i < 4; i++) patch_write(patch_result_checksum >> (i * 8));
+    patch_flush();
+
+    if(::close(patch_fd) != 0) patch_written = false;
+    return patch_written ? result::success : result::patch_unwritable;
+  }
 
-    patch_file.close();
-    return result::success;
+  result apply(
+    const uint8_t *patchdata, unsigned patchlength,
+    const uint8_t *sourcedata, unsigned sourcelength,
+    uint8_t *targetdata, unsigned &targetlength
+  ) {
+    target_fd = -1;
+    return run(patchdata, patchlength, sourcedata, sourcelength, targetdata, targetlength);
   }
 
+  //streaming form: the target is written to fd through a small buffer as it is
+  //produced, so it never has to be held in memory. checksums are verified all the same,
+  //but the output is only trustworthy once success is returned.
   result apply(
+    const uint8_t *patchdata, unsigned patchlength,
+    const uint8_t *sourcedata, unsigned sourcelength,
+    int fd
+  ) {
+    uint8_t buffer[target_buffer_size];
+    target_fd = fd;
+    target_buffer = buffer;
+    target_fill = 0;
+    target_written = true;
+
+    unsigned targetlength = ~0u;
+    result r = run(patchdata, patchlength, sourcedata, sourcelength, 0, targetlength);
+    target_flush();
+    target_fd = -1;
+
+    if(r == result::success && target_written == false) return result::target_unwritable;
+    return r;
+  }
+
+private:
+  enum : unsigned { target_buffer_size = 64 * 1024, patch_buffer_size = 64 * 1024 };
+
+  //returns the first offset in [offset, length) where x and y differ, or length
+  typedef unsigned (*compare_t)(const uint8_t *x, const uint8_t *y, unsigned offset, unsigned length);
+
+  static unsigned compare_scalar(const uint8_t *x, const uint8_t *y, unsigned offset, unsigned length) {
+    while(offset + 8 <= length && memcmp(x + offset, y + offset, 8) == 0) offset += 8;
+    while(offset < length && x[offset] == y[offset]) offset++;
+    return offset;
+  }
+
+  #if defined(NALL_CPUID_X86)
+  __attribute__((target("sse2")))
+  static unsigned compare_sse2(const uint8_t *x, const uint8_t *y, unsigned offset, unsigned length) {
+    while(offset + 16 <= length) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(x + offset));
+      __m128i b = _mm_loadu_si128((const __m128i*)(y + offset));
+      unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff;
+      if(mask) return offset + __builtin_ctz(mask);
+      offset += 16;
+    }
+    return compare_scalar(x, y, offset, length);
+  }
+
+  //two 32-byte blocks per step
+  __attribute__((target("avx2")))
+  static unsigned compare_avx2(const uint8_t *x, const uint8_t *y, unsigned offset, unsigned length) {
+    while(offset + 64 <= length) {
+      __m256i a0 = _mm256_loadu_si256((const __m256i*)(x + offset));
+      __m256i b0 = _mm256_loadu_si256((const __m256i*)(y + offset));
+      __m256i a1 = _mm256_loadu_si256((const __m256i*)(x + offset + 32));
+      __m256i b1 = _mm256_loadu_si256((const __m256i*)(y + offset + 32));
+      __m256i e0 = _mm256_cmpeq_epi8(a0, b0);
+      __m256i e1 = _mm256_cmpeq_epi8(a1, b1);
+      if(_mm256_movemask_epi8(_mm256_and_si256(e0, e1)) != -1) {
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(e0);
+        if(mask) return offset + __builtin_ctz(mask);
+        return offset + 32 + __builtin_ctz(~(unsigned)_mm256_movemask_epi8(e1));
+      }
+      offset += 64;
+    }
+    return compare_sse2(x, y, offset, length);
+  }
+  #endif
+
+  static compare_t compare_select() {
+    #if defined(NALL_CPUID_X86)
+    if(cpuid::supports(cpuid::avx2)) return compare_avx2;
+    if(cpuid::supports(cpuid::sse2)) return compare_sse2;
+    #endif
+    return compare_scalar;
+  }
+
+  //returns the first offset in [offset, length) where data is not zero, or length
+  static unsigned nonzero(const uint8_t *data, unsigned offset, unsigned length) {
+    static const uint8_t zero[8] = {0};
+    while(offset + 8 <= length && memcmp(data + offset, zero, 8) == 0) offset += 8;
+    while(offset < length && data[offset] == 0) offset++;
+    return offset;
+  }
+
+  result run(
     const uint8_t *patchdata, unsigned patchlength,
     const uint8_t *sourcedata, unsigned sourcelength,
     uint8_t *targetdata, unsigned &targetlength
@@ -108,24 +214,30 @@ struct ups {
     if(target_length < targetlength) return result::target_too_small;
     target_length = targetlength;
 
+    //unchanged runs are copied in bulk; checksums are taken over whole buffers at the end
     while(patch_offset < patch_length - 12) {
       unsigned length = decode();
-      while(length--) target_write(source_read());
+      target_copy(length);
       while(true) {
         uint8_t patch_xor = patch_read();
         target_write(patch_xor ^ source_read());
         if(patch_xor == 0) break;
       }
     }
-    while(source_offset < source_length) target_write(source_read());
-    while(target_offset < target_length) target_write(source_read());
+    target_copy(source_length - source_offset);
+    if(target_offset < target_length) target_copy(target_length - target_offset);
 
     uint32_t patch_read_checksum = 0, source_read_checksum = 0, target_read_checksum = 0;
     for(unsigned i = 0; i < 4; i++) source_read_checksum |= patch_read() << (i * 8);
     for(unsigned i = 0; i < 4; i++) target_read_checksum |= patch_read() << (i * 8);
-    uint32_t patch_result_checksum = ~patch_checksum;
-    source_checksum = ~source_checksum;
-    target_checksum = ~target_checksum;
+    uint32_t patch_result_checksum = crc32_calculate(patch_data, patch_offset);
+    source_checksum = crc32_calculate(source_data, source_offset);
+    if(target_fd < 0) {
+      target_checksum = crc32_calculate(target_data, min(target_offset, target_length));
+    } else {
+      target_flush();
+      target_checksum = ~target_checksum;
+    }
     for(unsigned i = 0; i < 4; i++) patch_read_checksum  |= patch_read() << (i * 8);
 
     if(patch_result_checksum != patch_read_checksum) return result::patch_invalid;
@@ -140,52 +252,90 @@ struct ups {
     }
   }
 
-private:
   uint8_t *patch_data, *source_data, *target_data;
   unsigned patch_length, source_length, target_length;
   unsigned patch_offset, source_offset, target_offset;
   unsigned patch_checksum, source_checksum, target_checksum;
-  file patch_file;
+
+  int patch_fd;
+  uint8_t *patch_buffer;
+  unsigned patch_fill;
+  bool patch_written;
+
+  int target_fd;
+  uint8_t *target_buffer;
+  unsigned target_fill;
+  bool target_written;
+
+  void patch_flush() {
+    patch_checksum = crc32_update(patch_checksum, patch_buffer, patch_fill);
+    if(patch_written) patch_written = file::write(patch_fd, patch_buffer, patch_fill);
+    patch_fill = 0;
+  }
+
+  //streamed targets are checksummed as they are written out
+  void target_flush() {
+    target_checksum = crc32_update(target_checksum, target_buffer, target_fill);
+    if(target_fill && target_written) target_written = file::write(target_fd, target_buffer, target_fill);
+    target_fill = 0;
+  }
 
   uint8_t patch_read() {
-    if(patch_offset < patch_length) {
-      uint8_t n = patch_data[patch_offset++];
-      patch_checksum = crc32_adjust(patch_checksum, n);
-      return n;
-    }
+    if(patch_offset < patch_length) return patch_data[patch_offset++];
     return 0x00;
   }
 
   uint8_t source_read() {
-    if(source_offset < source_length) {
-      uint8_t n = source_data[source_offset++];
-      source_checksum = crc32_adjust(source_checksum, n);
-      return n;
-    }
+    if(source_offset < source_length) return source_data[source_offset++];
     return 0x00;
   }
 
-  uint8_t target_read() {
-    uint8_t result = 0x00;
-    if(target_offset < target_length) {
-      result = target_data[target_offset];
-      target_checksum = crc32_adjust(target_checksum, result);
-    }
-    if(((target_offset++ & 255) == 0) && progress) {
-      progress(target_offset, source_length > target_length ? source_length : target_length);
+  //copies length bytes from source to target, as length calls of target_write(source_read())
+  //would: source bytes past its end read as zero, target bytes past its end are dropped
+  void target_copy(unsigned length) {
+    while(length) {
+      unsigned count = length;
+      const uint8_t *data = 0;
+      if(source_offset < source_length) {
+        count = min(count, source_length - source_offset);
+        data = source_data + source_offset;
+        source_offset += count;
+      }
+      length -= count;
+
+      unsigned keep = target_offset < target_length ? min(count, target_length - target_offset) : 0;
+      if(target_fd < 0) {
+        if(data) memcpy(target_data + target_offset, data, keep);
+        else memset(target_data + target_offset, 0, keep);
+      } else {
+        while(keep) {
+          unsigned block = min(keep, (unsigned)target_buffer_size - target_fill);
+          if(data) memcpy(target_buffer + target_fill, data, block), data += block;
+          else memset(target_buffer + target_fill, 0, block);
+          target_fill += block;
+          keep -= block;
+          if(target_fill == target_buffer_size) target_flush();
+        }
+      }
+
+      target_offset += count;
+      if(progress) progress(target_offset, source_length > target_length ? source_length : target_length);
     }
-    return result;
   }
 
   void patch_write(uint8_t n) {
-    patch_file.write(n);
-    patch_checksum = crc32_adjust(patch_checksum, n);
+    patch_buffer[patch_fill++] = n;
+    if(patch_fill == patch_buffer_size) patch_flush();
   }
 
   void target_write(uint8_t n) {
     if(target_offset < target_length) {
-      target_data[target_offset] = n;
-      target_checksum = crc32_adjust(target_checksum, n);
+      if(target_fd < 0) {
+        target_data[target_offset] = n;
+      } else {
+        target_buffer[target_fill++] = n;
+        if(target_fill == target_buffer_size) target_flush();
+      }
     }
     if(((target_offset++ & 255) == 0) && progress) {
       progress(target_offset, source_length > target_length ? source_length : target_length);
@@ -211,6 +361,7 @@ private:
       uint8_t x = patch_read();
       offset += (x & 0x7f) * shift;
       if(x & 0x80) break;
+      if(patch_offset >= patch_length) break;
       shift <<= 7;
       offset += shift;
     }
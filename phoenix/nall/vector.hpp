@@ -2,6 +2,8 @@
 #define NALL_VECTOR_HPP
 
 #include <initializer_list>
+#include <stdlib.h>
+#include <string.h>
 #include <new>
 #include <type_traits>
 #include <utility>
@@ -21,14 +23,46 @@ namespace nall {
   //reserve() overhead is reduced from quadratic time to amortized constant time
   //by resizing twice as much as requested.
   //
+  //objects are moved, not copied, into a new pool when it grows, and types that
+  //are relocatable are moved with a single memcpy (or realloc).
   //if objects hold memory address references to themselves (introspection), a
-  //valid copy constructor will be needed to keep pointers valid.
+  //valid move or copy constructor will be needed to keep pointers valid.
 
-  template<typename T> class linear_vector {
+  //objects that can be moved to another address with memcpy, without running their
+  //move constructor and destructor; containers that do not point into themselves opt in
+  template<typename T> struct is_relocatable { enum { value = std::is_trivially_copyable<T>::value }; };
+
+  //where linear_vector takes its memory from; see nall/arena.hpp for the alternative
+  struct heap_allocator {
+    void* allocate(unsigned size) { return malloc(size); }
+    void* reallocate(void *data, unsigned size, unsigned newsize) { return realloc(data, newsize); }
+    void release(void *data, unsigned size) { free(data); }
+  };
+
+  template<typename T, typename Allocator = heap_allocator> class linear_vector : protected Allocator {
   protected:
     T *pool;
     unsigned poolsize, objectsize;
 
+    //moves count objects into uninitialized memory, leaving source uninitialized
+    static void relocate(T *target, T *source, unsigned count) {
+      if(count == 0) return;
+      if(is_relocatable<T>::value) {
+        memmove((void*)target, (const void*)source, count * sizeof(T));
+      } else if(target < source) {
+        for(unsigned i = 0; i < count; i++) { new(target + i) T(std::move(source[i])); source[i].~T(); }
+      } else {
+        for(unsigned i = count; i--;) { new(target + i) T(std::move(source[i])); source[i].~T(); }
+      }
+    }
+
+    //opens count uninitialized slots at index, moving the objects after it up
+    void open(unsigned index, unsigned count) {
+      if(objectsize + count > poolsize) reserve(objectsize + count);
+      relocate(pool + index + count, pool + index, objectsize - index);
+      objectsize += count;
+    }
+
   public:
     unsigned size() const { return objectsize; }
     unsigned capacity() const { return poolsize; }
@@ -36,7 +70,7 @@ namespace nall {
     void reset() {
       if(pool) {
         for(unsigned i = 0; i < objectsize; i++) pool[i].~T();
-        free(pool);
+        Allocator::release(pool, poolsize * sizeof(T));
       }
       pool = 0;
       poolsize = 0;
@@ -46,13 +80,18 @@ namespace nall {
     void reserve(unsigned newsize) {
       newsize = bit::round(newsize);  //round to nearest power of two (for amortized growth)
 
-      T *poolcopy = (T*)calloc(newsize, sizeof(T));
-      for(unsigned i = 0; i < min(objectsize, newsize); i++) new(poolcopy + i) T(pool[i]);
-      for(unsigned i = 0; i < objectsize; i++) pool[i].~T();
-      free(pool);
-      pool = poolcopy;
-      poolsize = newsize;
+      for(unsigned i = newsize; i < objectsize; i++) pool[i].~T();
       objectsize = min(objectsize, newsize);
+
+      if(is_relocatable<T>::value) {
+        pool = (T*)Allocator::reallocate(pool, poolsize * sizeof(T), newsize * sizeof(T));
+      } else {
+        T *poolcopy = (T*)Allocator::allocate(newsize * sizeof(T));
+        relocate(poolcopy, pool, objectsize);
+        if(pool) Allocator::release(pool, poolsize * sizeof(T));
+        pool = poolcopy;
+      }
+      poolsize = newsize;
     }
 
     void resize(unsigned newsize) {
@@ -63,40 +102,63 @@ namespace nall {
         for(unsigned i = newsize; i < objectsize; i++) pool[i].~T();
       } else if(newsize > objectsize) {
         //vector is expanding; allocate new objects
-        for(unsigned i = objectsize; i < newsize; i++) new(pool + i) T;
+        for(unsigned i = objectsize; i < newsize; i++) new(pool + i) T();
       }
 
       objectsize = newsize;
     }
 
-    void append(const T data) {
-      if(objectsize + 1 > poolsize) reserve(objectsize + 1);
-      new(pool + objectsize++) T(data);
+    //constructs the new object in place.
+    //the arguments may refer to objects in this vector, so when the pool has to grow,
+    //the new object is constructed before the old pool is released.
+    template<typename... Args> void emplace_append(Args&&... args) {
+      if(objectsize + 1 > poolsize) {
+        unsigned newsize = bit::round(objectsize + 1);
+        T *poolcopy = (T*)Allocator::allocate(newsize * sizeof(T));
+        new(poolcopy + objectsize) T(std::forward<Args>(args)...);
+        relocate(poolcopy, pool, objectsize);
+        if(pool) Allocator::release(pool, poolsize * sizeof(T));
+        pool = poolcopy;
+        poolsize = newsize;
+      } else {
+        new(pool + objectsize) T(std::forward<Args>(args)...);
+      }
+      objectsize++;
     }
 
-    template<typename U> void insert(unsigned index, const U list) {
-      linear_vector<T> merged;
-      for(unsigned i = 0; i < index; i++) merged.append(pool[i]);
-      foreach(item, list) merged.append(item);
-      for(unsigned i = index; i < objectsize; i++) merged.append(pool[i]);
-      operator=(merged);
+    void append(const T &data) {
+      emplace_append(data);
     }
 
-    void insert(unsigned index, const T item) {
-      insert(index, linear_vector<T>{ item });
+    void append(T &&data) {
+      emplace_append(std::move(data));
+    }
+
+    template<typename U> void insert(unsigned index, const U &list) {
+      if((const void*)&list == (const void*)this) return insert(index, linear_vector(*this));
+      unsigned count = container_size(list);
+      open(index, count);
+      for(unsigned i = 0; i < count; i++) new(pool + index + i) T(list[i]);
+    }
+
+    void insert(unsigned index, T item) {
+      open(index, 1);
+      new(pool + index) T(std::move(item));
     }
 
     void remove(unsigned index, unsigned count = 1) {
-      for(unsigned i = index; count + i < objectsize; i++) {
-        pool[i] = pool[count + i];
-      }
-      if(count + index >= objectsize) resize(index);  //every element >= index was removed
-      else resize(objectsize - count);
+      if(count + index >= objectsize) return resize(index);  //every element >= index was removed
+      for(unsigned i = index; i < index + count; i++) pool[i].~T();
+      relocate(pool + index, pool + index + count, objectsize - index - count);
+      objectsize -= count;
     }
 
     linear_vector() : pool(0), poolsize(0), objectsize(0) {
     }
 
+    explicit linear_vector(const Allocator &allocator) : Allocator(allocator), pool(0), poolsize(0), objectsize(0) {
+    }
+
     linear_vector(std::initializer_list<T> list) : pool(0), poolsize(0), objectsize(0) {
       for(const T *p = list.begin(); p != list.end(); ++p) append(*p);
     }
@@ -105,22 +167,25 @@ namespace nall {
       reset();
     }
 
-    //copy
-    inline linear_vector<T>& operator=(const linear_vector<T> &source) {
+    //copy; a copy constructed vector shares the allocator of its source
+    inline linear_vector& operator=(const linear_vector &source) {
+      if(this == &source) return *this;
       reset();
       reserve(source.capacity());
-      resize(source.size());
-      for(unsigned i = 0; i < source.size(); i++) operator[](i) = source.operator[](i);
+      for(unsigned i = 0; i < source.size(); i++) new(pool + i) T(source.pool[i]);
+      objectsize = source.size();
       return *this;
     }
 
-    linear_vector(const linear_vector<T> &source) : pool(0), poolsize(0), objectsize(0) {
+    linear_vector(const linear_vector &source) : Allocator(source), pool(0), poolsize(0), objectsize(0) {
       operator=(source);
     }
 
-    //move
-    inline linear_vector<T>& operator=(linear_vector<T> &&source) {
+    //move; the pool comes along with the allocator it belongs to
+    inline linear_vector& operator=(linear_vector &&source) {
+      if(this == &source) return *this;
       reset();
+      Allocator::operator=(source);
       pool = source.pool;
       poolsize = source.poolsize;
       objectsize = source.objectsize;
@@ -129,7 +194,7 @@ namespace nall {
       return *this;
     }
 
-    linear_vector(linear_vector<T> &&source) : pool(0), poolsize(0), objectsize(0) {
+    linear_vector(linear_vector &&source) : Allocator(source), pool(0), poolsize(0), objectsize(0) {
       operator=(std::move(source));
     }
 
@@ -294,7 +359,8 @@ namespace nall {
     iterator end() { return iterator(*this, objectsize); }
   };
 
-  template<typename T> struct has_size<linear_vector<T>> { enum { value = true }; };
+  template<typename T, typename Allocator> struct has_size<linear_vector<T, Allocator>> { enum { value = true }; };
+  template<typename T, typename Allocator> struct is_relocatable<linear_vector<T, Allocator>> { enum { value = true }; };
   template<typename T> struct has_size<pointer_vector<T>> { enum { value = true }; };
 }
 
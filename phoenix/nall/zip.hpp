@@ -1,19 +1,23 @@
 #ifndef NALL_UNZIP_HPP
 #define NALL_UNZIP_HPP
 
+#include <nall/crc32.hpp>
+#include <nall/file.hpp>
 #include <nall/filemap.hpp>
 #include <nall/inflate.hpp>
+#include <nall/sort.hpp>
 #include <nall/string.hpp>
+#include <nall/thread.hpp>
 #include <nall/vector.hpp>
 
 namespace nall {
 
 struct zip {
   struct File {
-    string name;
+    const char *name;  //null-terminated, stored in the archive's name pool
     const uint8_t *data;
-    unsigned size;
-    unsigned csize;
+    uint64_t size;
+    uint64_t csize;
     unsigned cmode;  //0 = uncompressed, 8 = deflate
     unsigned crc32;
   };
@@ -28,39 +32,51 @@ struct zip {
     return true;
   }
 
-  inline bool open(const uint8_t *data, unsigned size) {
+  //reads the central directory in a single pass. names are copied into one pool and
+  //entries into one preallocated vector, so there is no allocation per entry.
+  //Zip64 archives (over 4GB or 65535 entries) are supported.
+  inline bool open(const uint8_t *data, uint64_t size) {
+    reset();
     if(size < 22) return false;
 
     filedata = data;
     filesize = size;
 
-    file.reset();
-
+    //the end of central directory record is only followed by the archive comment
     const uint8_t *footer = 0;
-    
-    for (unsigned eocd_size = 22;
-        eocd_size < 256 && eocd_size < size; // Somewhat arbitrary maximum.
-        eocd_size++) {
-      const uint8_t *tmp = data + size - eocd_size;
-      unsigned eocd_magic = read(tmp + 0, 4);
-      if (eocd_magic == 0x06054b50) {
-        unsigned comment_length = read(tmp + 20, 2);
-        if (comment_length + 22 == eocd_size) {
-          footer = tmp;
-          break;
-        }
+    for(unsigned eocd = 22; eocd <= 22 + 65535 && eocd <= size; eocd++) {
+      const uint8_t *p = data + size - eocd;
+      if(read(p + 0, 4) == 0x06054b50 && read(p + 20, 2) + 22 == eocd) {
+        footer = p;
+        break;
       }
     }
+    if(footer == 0) return false;
 
-    if (!footer)
-      return false;
+    uint64_t entries = read(footer + 10, 2);
+    uint64_t dirsize = read(footer + 12, 4);
+    uint64_t diroffset = read(footer + 16, 4);
 
-    const uint8_t *directory = data + read(footer + 16, 4);
+    //a Zip64 locator right before the record points to the 64-bit version of it
+    if(footer - data >= 20 && read(footer - 20, 4) == 0x07064b50) {
+      uint64_t offset = read(footer - 20 + 8, 8);
+      if(size < 56 || offset > size - 56 || read(data + offset, 4) != 0x06064b50) return false;
+      entries = read(data + offset + 32, 8);
+      dirsize = read(data + offset + 40, 8);
+      diroffset = read(data + offset + 48, 8);
+    }
+    if(diroffset > size || dirsize > size - diroffset) return false;
+    if(entries > dirsize / 46) return false;  //each record takes at least 46 bytes
 
-    while(true) {
-      unsigned signature = read(directory + 0, 4);
-      if(signature != 0x02014b50) break;
+    //names and their terminators never take more room than the records they are in
+    names = new char[dirsize];
+    char *name = names;
+    file.reserve(entries);
 
+    const uint8_t *directory = data + diroffset;
+    const uint8_t *end = directory + dirsize;
+
+    while(end - directory >= 46 && read(directory + 0, 4) == 0x02014b50) {
       File file;
       file.cmode = read(directory + 10, 2);
       file.crc32 = read(directory + 16, 4);
@@ -70,17 +86,35 @@ struct zip {
       unsigned namelength = read(directory + 28, 2);
       unsigned extralength = read(directory + 30, 2);
       unsigned commentlength = read(directory + 32, 2);
+      uint64_t offset = read(directory + 42, 4);
+      if((uint64_t)(end - directory) < 46 + namelength + extralength + commentlength) return false;
 
-      char *filename = new char[namelength + 1];
-      memcpy(filename, directory + 46, namelength);
-      filename[namelength] = 0;
-      file.name = filename;
-      delete[] filename;
+      //Zip64 extended information holds the fields that do not fit, in this order
+      const uint8_t *extra = directory + 46 + namelength;
+      const uint8_t *extraend = extra + extralength;
+      while(extraend - extra >= 4) {
+        unsigned id = read(extra + 0, 2), length = read(extra + 2, 2);
+        const uint8_t *p = extra + 4, *q = p + length;
+        if(length > (unsigned)(extraend - p)) break;
+        if(id == 0x0001) {
+          if(file.size  == 0xffffffff && q - p >= 8) file.size  = read(p, 8), p += 8;
+          if(file.csize == 0xffffffff && q - p >= 8) file.csize = read(p, 8), p += 8;
+          if(offset     == 0xffffffff && q - p >= 8) offset     = read(p, 8), p += 8;
+        }
+        extra = q;
+      }
 
-      unsigned offset = read(directory + 42, 4);
+      memcpy(name, directory + 46, namelength);
+      name[namelength] = 0;
+      file.name = name;
+      name += namelength + 1;
+
+      if(size < 30 || offset > size - 30) return false;
       unsigned offsetNL = read(data + offset + 26, 2);
       unsigned offsetEL = read(data + offset + 28, 2);
-      file.data = data + offset + 30 + offsetNL + offsetEL;
+      offset += 30 + offsetNL + offsetEL;
+      if(offset > size || file.csize > size - offset) return false;
+      file.data = data + offset;
 
       directory += 46 + namelength + extralength + commentlength;
 
@@ -90,8 +124,28 @@ struct zip {
     return true;
   }
 
+  //finds an entry by name; the name index is sorted on first use
+  inline File* find(const char *name) {
+    if(sorted == 0) {
+      sorted = new index[file.size()];
+      for(unsigned n = 0; n < file.size(); n++) sorted[n].name = file[n].name, sorted[n].file = n;
+      sort(sorted, file.size());
+    }
+
+    unsigned lo = 0, hi = file.size();
+    while(lo < hi) {
+      unsigned mid = lo + (hi - lo) / 2;
+      int result = strcmp(sorted[mid].name, name);
+      if(result == 0) return &file[sorted[mid].file];
+      if(result < 0) lo = mid + 1;
+      else hi = mid;
+    }
+    return 0;
+  }
+
   inline bool extract(File &file, uint8_t *&data, unsigned &size) {
     data = 0, size = 0;
+    if(file.size > 0xffffffff || file.csize > 0xffffffff) return false;
 
     if(file.cmode == 0) {
       size = file.size;
@@ -114,22 +168,278 @@ struct zip {
     return false;
   }
 
+  //gives read-only access to the contents of an entry without extracting it.
+  //stored entries point straight into the archive mapping. deflated entries are decoded
+  //into a buffer kept until close(), lazily: only far enough to cover the first length
+  //bytes, resuming from there when more is asked for. the CRC32 is verified once the
+  //whole entry has been decoded. size receives the number of bytes available.
+  //deflated entries must be elements of this->file; copies and other archives' entries fail.
+  inline bool view(File &file, const uint8_t *&data, uint64_t &size, uint64_t length = ~0ull) {
+    data = 0, size = 0;
+    if(length > file.size) length = file.size;
+
+    if(file.cmode == 0) {
+      data = file.data;
+      size = file.size;
+      return true;
+    }
+
+    if(file.cmode != 8 || file.size > 0xffffffff || file.csize > 0xffffffff) return false;
+
+    if(this->file.size() == 0 || &file < &this->file[0] || &file >= &this->file[0] + this->file.size()) return false;
+    unsigned index = &file - &this->file[0];
+    decoding *entry = 0;
+    for(unsigned n = 0; n < decoded.size(); n++) {
+      if(decoded[n].index == index) entry = &decoded[n];
+    }
+    if(entry == 0) {
+      decoding d = { index, new uint8_t[file.size], 0, new inflate_stream, file.data, (unsigned)file.csize, false };
+      decoded.append(d);
+      entry = &decoded[decoded.size() - 1];
+    }
+
+    //decode in steps of at least 64KB, and once more at the end to reach the end of stream
+    while(entry->stream && (entry->size < length || entry->size == file.size)) {
+      uint8_t *out = entry->data + entry->size;
+      unsigned outlen = min(file.size, max(length, entry->size + 65536)) - entry->size;
+      inflate_stream::status status = entry->stream->run(entry->in, entry->inlen, out, outlen);
+      entry->size = out - entry->data;
+      //wanting more room once the buffer is full means the stream is longer than stated
+      if(status == inflate_stream::status::output && entry->size < file.size) continue;
+
+      entry->failed = status != inflate_stream::status::finished || entry->size != file.size
+                   || crc32_calculate(entry->data, entry->size) != file.crc32;
+      delete entry->stream;
+      entry->stream = 0;
+    }
+
+    if(entry->failed || entry->size < length) return false;
+    data = entry->data;
+    size = entry->size;
+    return true;
+  }
+
+  //writes an entry to a file descriptor, decompressing through a fixed-size window,
+  //so that memory use does not depend on the size of the entry. the CRC32 is verified.
+  inline bool extract(File &file, int fd) {
+    inflate_stream *stream = new inflate_stream;
+    uint8_t *window = new uint8_t[1 << 16];
+    bool result = extract(file, fd, *stream, window, 1 << 16, function<void (unsigned)>());
+    delete[] window;
+    delete stream;
+    return result;
+  }
+
+  struct job {
+    unsigned index;   //into file
+    string filename;  //output path
+    bool success;
+  };
+
+  //extracts several entries at once on a pool of worker threads (0 = one per processor).
+  //each output file is preallocated and, for entries that fit in the window, written
+  //with a single call. progress is reported as bytes written so far and in total,
+  //always from the calling thread, which is otherwise blocked until all jobs finish.
+  //returns true if every entry was extracted and passed its CRC32 check.
+  inline bool extract(linear_vector<job> &jobs, unsigned threads = 0,
+    function<void (uint64_t done, uint64_t total)> progress = function<void (uint64_t, uint64_t)>()
+  ) {
+    if(jobs.size() == 0) return true;
+
+    pool state;
+    state.jobs = &jobs;
+    state.order = new pool::pending[jobs.size()];
+    state.next = 0;
+    state.running = 0;
+    state.done = 0;
+    state.total = 0;
+
+    //largest entries first, so that one big entry does not finish last on its own
+    for(unsigned n = 0; n < jobs.size(); n++) {
+      jobs[n].success = false;
+      state.order[n].job = n;
+      state.order[n].size = file[jobs[n].index].size;
+      state.total += state.order[n].size;
+    }
+    sort(state.order, jobs.size());
+
+    if(threads == 0) threads = thread::processors();
+    if(threads > jobs.size()) threads = jobs.size();
+    state.running = threads;
+
+    thread *workers = new thread[threads];
+    for(unsigned n = 0; n < threads; n++) workers[n] = thread(&zip::worker, this, &state);
+
+    while(true) {
+      state.signal.wait();
+      state.lock.lock();
+      uint64_t done = state.done;
+      bool finished = state.running == 0;
+      state.lock.unlock();
+      if(progress) progress(done, state.total);
+      if(finished) break;
+    }
+
+    for(unsigned n = 0; n < threads; n++) workers[n].join();
+    delete[] workers;
+    delete[] state.order;
+
+    bool result = true;
+    for(unsigned n = 0; n < jobs.size(); n++) result &= jobs[n].success;
+    return result;
+  }
+
   inline void close() {
+    reset();
     if(fm.open()) fm.close();
   }
 
+  zip() : names(0), sorted(0) {
+  }
+
   ~zip() {
     close();
   }
 
 protected:
+  struct pool {
+    struct pending {
+      unsigned job;
+      uint64_t size;
+      bool operator<(const pending &source) const { return size > source.size; }
+    };
+
+    linear_vector<job> *jobs;
+    pending *order;
+    unsigned next;
+    unsigned running;
+    uint64_t done;
+    uint64_t total;
+    mutex lock;
+    event signal;
+  };
+
+  enum : unsigned { WorkerWindow = 1 << 20 };
+
+  inline bool extract(File &file, int fd, inflate_stream &stream, uint8_t *window, unsigned windowsize, function<void (unsigned)> written) {
+    enum : unsigned { Chunk = 1 << 30 };  //entries may exceed what one call can take
+    uint32_t crc32 = ~0;
+    nall::file::preallocate(fd, file.size);
+
+    if(file.cmode == 0) {
+      for(uint64_t offset = 0; offset < file.size;) {
+        unsigned length = min(file.size - offset, (uint64_t)Chunk);
+        crc32 = crc32_update(crc32, file.data + offset, length);
+        if(nall::file::write(fd, file.data + offset, length) == false) return false;
+        if(written) written(length);
+        offset += length;
+      }
+      return ~crc32 == file.crc32;
+    }
+
+    if(file.cmode == 8) {
+      const uint8_t *in = file.data;
+      uint64_t remaining = file.csize, size = 0;
+      unsigned inlen = 0;
+      stream.reset();
+
+      while(true) {
+        if(inlen == 0) {
+          inlen = min(remaining, (uint64_t)Chunk);
+          remaining -= inlen;
+        }
+        uint8_t *out = window;
+        unsigned outlen = windowsize;
+        inflate_stream::status status = stream.run(in, inlen, out, outlen);
+        unsigned length = out - window;
+        crc32 = crc32_update(crc32, window, length);
+        size += length;
+        if(nall::file::write(fd, window, length) == false) return false;
+        if(written) written(length);
+        if(status == inflate_stream::status::output) continue;
+        if(status == inflate_stream::status::input && remaining) continue;
+        if(status != inflate_stream::status::finished) return false;
+        break;
+      }
+
+      return size == file.size && ~crc32 == file.crc32;
+    }
+
+    return false;
+  }
+
+  void worker(pool *state) {
+    inflate_stream *stream = new inflate_stream;
+    uint8_t *window = new uint8_t[WorkerWindow];
+    function<void (unsigned)> written = [state](unsigned length) {
+      state->lock.lock();
+      state->done += length;
+      state->lock.unlock();
+      state->signal.signal();
+    };
+
+    while(true) {
+      state->lock.lock();
+      unsigned n = state->next < state->jobs->size() ? state->order[state->next++].job : ~0u;
+      state->lock.unlock();
+      if(n == ~0u) break;
+
+      job &j = (*state->jobs)[n];
+      int fd = nall::file::create(j.filename);
+      if(fd < 0) continue;
+      bool success = extract(file[j.index], fd, *stream, window, WorkerWindow, written);
+      j.success = ::close(fd) == 0 && success;
+    }
+
+    delete[] window;
+    delete stream;
+
+    state->lock.lock();
+    state->running--;
+    state->lock.unlock();
+    state->signal.signal();
+  }
+
+  struct index {
+    const char *name;
+    unsigned file;
+    bool operator<(const index &source) const { return strcmp(name, source.name) < 0; }
+  };
+
   filemap fm;
   const uint8_t *filedata;
-  unsigned filesize;
+  uint64_t filesize;
+  char *names;
+  index *sorted;
+
+  struct decoding {
+    unsigned index;
+    uint8_t *data;
+    uint64_t size;           //decoded so far
+    inflate_stream *stream;  //released once the entry is complete
+    const uint8_t *in;
+    unsigned inlen;
+    bool failed;
+  };
+  linear_vector<decoding> decoded;
+
+  inline void reset() {
+    for(unsigned n = 0; n < decoded.size(); n++) {
+      delete[] decoded[n].data;
+      if(decoded[n].stream) delete decoded[n].stream;
+    }
+    decoded.reset();
+    file.reset();
+    if(names) delete[] names;
+    if(sorted) delete[] sorted;
+    names = 0;
+    sorted = 0;
+  }
 
-  unsigned read(const uint8_t *data, unsigned size) {
-    unsigned result = 0, shift = 0;
-    while(size--) { result |= *data++ << shift; shift += 8; }
+  uint64_t read(const uint8_t *data, unsigned size) {
+    uint64_t result = 0;
+    unsigned shift = 0;
+    while(size--) { result |= (uint64_t)*data++ << shift; shift += 8; }
     return result;
   }
 
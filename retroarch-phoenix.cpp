@@ -1,4 +1,5 @@
 #include <phoenix.hpp>
+#include <nall/arena.hpp>
 #include <cstdlib>
 
 #ifndef _WIN32
@@ -20,6 +21,7 @@
 #include "settings.hpp"
 #include "dynamic.h"
 #include "libretro.h"
+#include "romcache.hpp"
 
 #ifdef _WIN32
 #include "updater.hpp"
@@ -51,9 +53,10 @@ namespace Internal
       return true;
    }
 
-   static lstring split_strings(const char *text, unsigned size)
+   // The strings are views into text; only the list itself is allocated, from pool.
+   static linear_vector<string_view, arena_allocator> split_strings(const char *text, unsigned size, arena &pool)
    {
-      lstring list;
+      linear_vector<string_view, arena_allocator> list(pool);
 
       unsigned ptr = 0;
       list.append(text);
@@ -142,9 +145,16 @@ class LogWindow : public ToggleWindow
       }
 
       // Push strings which are split by NUL. text[size] needs to be NUL.
+      // Output arrives in many small pushes, so the split reuses one arena.
       void push(const char *text, unsigned size)
       {
-         push(Internal::split_strings(text, size));
+         {
+            auto list = Internal::split_strings(text, size, pool);
+            foreach (str, list)
+               log.append(str);
+         }
+         pool.reset();
+         box.setText(log);
       }
 
       void clear() { log = ""; box.setText(log); }
@@ -153,6 +163,7 @@ class LogWindow : public ToggleWindow
       VerticalLayout layout;
       TextEdit box;
       Label label;
+      arena pool;
 
       HorizontalLayout hbox;
       Button select_all;
@@ -349,6 +360,9 @@ class MainWindow : public Window
       bool m_cli_custom_path;
       bool load_no_rom;
 
+      ROMCache rom_cache;
+      lstring rom_exts;
+
       struct netplay
       {
          netplay() : file(0)
@@ -716,6 +730,11 @@ class MainWindow : public Window
             return gui_path;
       }
 
+      static string rom_cache_path()
+      {
+         return {basedir(), "rom-cache\\"};
+      }
+
       string cli_config_path()
       {
          string tmp;
@@ -762,6 +781,15 @@ class MainWindow : public Window
          return gui_path;
       }
 
+      static string rom_cache_path()
+      {
+         const char *home = std::getenv("HOME");
+         if (!home)
+            return "";
+
+         return {home, "/Library/Caches/retroarch-phoenix/"};
+      }
+
       string cli_config_path()
       {
          const char *path = std::getenv("HOME");
@@ -806,6 +834,27 @@ class MainWindow : public Window
          return gui_path;
       }
 
+      static string rom_cache_path()
+      {
+         const char *path = std::getenv("XDG_CACHE_HOME");
+         const char *home_path = std::getenv("HOME");
+         string dir;
+         if (path)
+            dir = path;
+         else if (home_path)
+         {
+            dir = {home_path, "/.cache"};
+            mkdir(dir, 0755);
+         }
+         else
+            return "";
+
+         dir.append("/retroarch");
+         mkdir(dir, 0755);
+         dir.append("/phoenix-roms/");
+         return dir;
+      }
+
       string cli_config_path()
       {
          const char *path = std::getenv("XDG_CONFIG_HOME");
@@ -963,6 +1012,15 @@ class MainWindow : public Window
             rom_type.allow_patch(patches);
          rom_type.setConfig(configs.gui);
 
+         bool rom_cache_enable = true;
+         int rom_cache_size = 1024;
+         configs.gui.get("rom_cache_enable", rom_cache_enable);
+         configs.gui.get("rom_cache_size", rom_cache_size);
+         if (rom_cache_enable)
+         {
+            rom_cache.set_directory(rom_cache_path());
+            rom_cache.set_budget((uint64_t)max(rom_cache_size, 0) << 20);
+         }
 
          if (!m_cli_custom_path)
             m_cli_path = cli_config_path();
@@ -1036,6 +1094,7 @@ class MainWindow : public Window
       {
          struct retro_system_info info = {0};
          lstring exts = get_system_info(info, libretro_path, load_no_rom);
+         rom_exts = exts;
 
          string filter;
          if (exts.size() == 0)
@@ -1149,6 +1208,47 @@ end:
          return ret;
       }
 
+      // Zipped ROMs are extracted once into the ROM cache and RetroArch loads the cached copy.
+      // Saves would otherwise end up in the cache, so point them next to the archive
+      // unless RetroArch has save directories configured.
+      bool append_cached_rom(string& rom_path, linear_vector<const char*>& vec_cmd)
+      {
+         static string cached_path;
+         static string savefile_path;
+         static string savestate_path;
+
+         if (!rom_cache.resolve(rom_path, rom_exts, cached_path))
+         {
+            print("ROM cache: failed to extract ", rom_path, ", passing archive as-is.\n");
+            cached_path = rom_path;
+         }
+
+         // Patch up front, so RetroArch gets a ready-made ROM and need not patch it again.
+         if (rom_type.allow_patch() && rom_cache.patch(rom_path, cached_path, cached_path))
+            vec_cmd.append("--no-patch");
+
+         vec_cmd.append(cached_path);
+         if (cached_path == rom_path)
+            return true;
+
+         string tmp;
+         if (!configs.cli.get("savefile_directory", tmp))
+         {
+            savefile_path = {nall::basename(rom_path), ".srm"};
+            vec_cmd.append("-s");
+            vec_cmd.append(savefile_path);
+         }
+
+         if (!configs.cli.get("savestate_directory", tmp))
+         {
+            savestate_path = {nall::basename(rom_path), ".state"};
+            vec_cmd.append("-S");
+            vec_cmd.append(savestate_path);
+         }
+
+         return true;
+      }
+
       bool append_rom(string& rom_path, linear_vector<const char*>& vec_cmd)
       {
          // Need static since we're referencing a const char*.
@@ -1171,8 +1271,7 @@ end:
                   show_error("No ROM selected :(");
                   return false;
                }
-               vec_cmd.append(rom_path);
-               return true;
+               return append_cached_rom(rom_path, vec_cmd);
 
             case SGB:
                if (!ext_rom.get_sgb_bios(rom_path))
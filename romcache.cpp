@@ -0,0 +1,245 @@
+#include <nall/directory.hpp>
+#include <nall/file.hpp>
+#include <nall/filemap.hpp>
+#include <nall/patch.hpp>
+#include <nall/sort.hpp>
+#include <nall/zip.hpp>
+#include "romcache.hpp"
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+using namespace nall;
+
+ROMCache::ROMCache() : budget(0)
+{}
+
+void ROMCache::set_directory(const string &dir_)
+{
+   dir = dir_;
+   if (dir.length() > 0 && !dir.endswith("/") && !dir.endswith("\\"))
+      dir.append("/");
+}
+
+void ROMCache::set_budget(uint64_t bytes)
+{
+   budget = bytes;
+}
+
+bool ROMCache::resolve(const string &path, const lstring &exts, string &out)
+{
+   out = path;
+   if (dir.length() == 0 || !path.iendswith(".zip"))
+      return true;
+
+   zip z;
+   if (!z.open(path))
+      return false;
+
+   int index = -1;
+   for (unsigned i = 0; i < z.file.size() && index < 0; i++)
+   {
+      string ext = extension(z.file[i].name);
+      for (unsigned j = 0; j < exts.size(); j++)
+      {
+         if (ext.iequals(exts[j]))
+         {
+            index = i;
+            break;
+         }
+      }
+   }
+
+   // No known extension, assume the largest file is the ROM.
+   for (unsigned i = 0; i < z.file.size() && index < 0; i++)
+   {
+      if (strend(z.file[i].name, "/"))
+         continue;
+      if (index < 0 || z.file[i].size > z.file[index].size)
+         index = i;
+   }
+
+   if (index < 0)
+      return false;
+
+   auto &entry = z.file[index];
+   string entry_dir = {dir, hex<8>(entry.crc32), "-", entry.size, "/"};
+   string rom_path = {entry_dir, notdir(entry.name)};
+
+   if (file::exists(rom_path) && file::size(rom_path) == entry.size)
+   {
+      print("ROM cache hit: ", rom_path, "\n");
+      touch(rom_path);
+      out = rom_path;
+      return true;
+   }
+
+   mkdir(dir, 0755);
+   mkdir(entry_dir, 0755);
+
+   // Write to a temporary file first, so a partially written ROM is never picked up.
+   // The entry is streamed to disk, so large ROMs are never held in memory whole.
+   string tmp_path = {rom_path, ".tmp"};
+   int fd = file::create(tmp_path);
+   if (fd < 0)
+      return false;
+
+   bool ret = z.extract(entry, fd);
+   ret = ::close(fd) == 0 && ret;
+   ret = ret && rename(tmp_path, rom_path) == 0;
+   z.close();
+
+   if (!ret)
+   {
+      ::remove(tmp_path);
+      return false;
+   }
+
+   print("ROM cache miss, extracted to: ", rom_path, "\n");
+   out = rom_path;
+   evict(entry_dir);
+   return true;
+}
+
+bool ROMCache::patch(const string &rom_path, const string &source_path, string &out)
+{
+   out = source_path;
+   if (dir.length() == 0)
+      return false;
+
+   // Same lookup order as RetroArch's own soft-patching.
+   static const char *patch_exts[] = { ".ups", ".bps", ".ips" };
+   string patch_path;
+   for (unsigned i = 0; i < sizeof(patch_exts) / sizeof(patch_exts[0]); i++)
+   {
+      string path = {nall::basename(rom_path), patch_exts[i]};
+      if (file::exists(path))
+      {
+         patch_path = path;
+         break;
+      }
+   }
+
+   if (patch_path.length() == 0)
+      return false;
+
+   filemap source, patch_file;
+   if (!source.open(source_path, filemap::mode::read) || !patch_file.open(patch_path, filemap::mode::read))
+      return false;
+
+   string entry_dir = {dir,
+      hex<8>(crc32_calculate(source.data(), source.size())), "-", source.size(), "+",
+      hex<8>(crc32_calculate(patch_file.data(), patch_file.size())), "-", patch_file.size(), "/"};
+   // Named after the ROM actually patched; for a zipped ROM, rom_path is the archive.
+   string patched_path = {entry_dir, notdir(source_path)};
+
+   if (file::exists(patched_path))
+   {
+      print("ROM cache hit: ", patched_path, "\n");
+      touch(patched_path);
+      out = patched_path;
+      return true;
+   }
+
+   uint8_t *data;
+   unsigned size;
+   if (!nall::patch::apply(patch_file.data(), patch_file.size(), source.data(), source.size(), data, size))
+   {
+      print("ROM cache: failed to apply ", patch_path, "\n");
+      return false;
+   }
+
+   mkdir(dir, 0755);
+   mkdir(entry_dir, 0755);
+
+   string tmp_path = {patched_path, ".tmp"};
+   int fd = file::create(tmp_path);
+   bool ret = fd >= 0 && file::write(fd, data, size);
+   ret = (fd < 0 || ::close(fd) == 0) && ret;
+   ret = ret && rename(tmp_path, patched_path) == 0;
+   delete[] data;
+
+   if (!ret)
+   {
+      ::remove(tmp_path);
+      return false;
+   }
+
+   print("ROM cache miss, patched with ", patch_path, " to: ", patched_path, "\n");
+   out = patched_path;
+   evict(entry_dir);
+   return true;
+}
+
+void ROMCache::evict(const string &keep)
+{
+   if (budget == 0)
+      return;
+
+   struct cache_entry
+   {
+      string folder;
+      lstring files;
+      uint64_t size;
+      time_t used;
+
+      bool operator<(const cache_entry &other) const { return used < other.used; }
+   };
+
+   linear_vector<cache_entry> entries;
+   uint64_t total = 0;
+
+   // One pass over the cache, with sizes and times from the walk itself.
+   // Files of one folder arrive together, so each cache entry is one run of the walk.
+   directory::walk(dir, [&](const directory::entry &item) {
+      if (item.type != directory::entry::kind::file)
+         return;
+      auto slash = strpos(item.name, "/");
+      if (!slash || strpos((const char*)item.name + slash() + 1, "/"))
+         return;
+
+      string folder = {dir, substr(item.name, 0, slash() + 1)};
+      if (entries.size() == 0 || entries[entries.size() - 1].folder != folder)
+         entries.append({folder, lstring(), 0, 0});
+
+      cache_entry &entry = entries[entries.size() - 1];
+      entry.files.append({dir, item.name});
+      entry.size += item.size;
+      entry.used = max(entry.used, item.modify);
+      total += item.size;
+   });
+
+   if (total <= budget || entries.size() == 0)
+      return;
+
+   // Oldest first.
+   sort(&entries[0], entries.size());
+
+   foreach (entry, entries)
+   {
+      if (total <= budget)
+         break;
+      if (entry.folder == keep)
+         continue;
+
+      print("ROM cache: evicting ", entry.folder, "\n");
+      foreach (path, entry.files)
+         ::remove(path);
+      rmdir(entry.folder);
+      total -= entry.size;
+   }
+}
+
+// Last use is tracked by modification time.
+void ROMCache::touch(const string &path)
+{
+#ifdef _WIN32
+   _wutime(utf16_t(path), 0);
+#else
+   utime(path, 0);
+#endif
+}
+
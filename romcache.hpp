@@ -0,0 +1,39 @@
+#ifndef __RetroArch_ROMCACHE_HPP
+#define __RetroArch_ROMCACHE_HPP
+
+#include <nall/string.hpp>
+#include <stdint.h>
+
+// Content-addressed cache of ROMs extracted from zip archives.
+// An entry lives in <dir>/<crc32>-<size>/<name in archive>, so repeated launches
+// of the same zipped ROM skip decompression, and the ROM keeps its original name.
+// Soft-patched ROMs are cached the same way, keyed on both the ROM and the patch.
+// Least recently used entries are evicted once the cache outgrows its budget.
+class ROMCache
+{
+   public:
+      ROMCache();
+
+      void set_directory(const nall::string &dir);
+      void set_budget(uint64_t bytes);
+
+      // If path is a zip archive, returns the cached path of the ROM inside it,
+      // extracting it first if needed. The first entry with one of exts is used,
+      // otherwise the largest entry. Other paths are returned unchanged.
+      bool resolve(const nall::string &path, const nall::lstring &exts, nall::string &out);
+
+      // If an IPS, UPS or BPS patch named after rom_path exists, returns the cached path
+      // of source_path with it applied, patching it first if needed.
+      // Returns false, with out set to source_path, if there is nothing to patch.
+      bool patch(const nall::string &rom_path, const nall::string &source_path, nall::string &out);
+
+   private:
+      nall::string dir;
+      uint64_t budget;
+
+      void evict(const nall::string &keep);
+      static void touch(const nall::string &path);
+};
+
+#endif
+
@@ -4,12 +4,16 @@
 #include <nall/thread.hpp>
 #include <nall/file.hpp>
 #include <nall/zip.hpp>
+#include <nall/crc32.hpp>
+#include <nall/base64.hpp>
+#include <nall/filemap.hpp>
+#include <nall/ups.hpp>
 #include "updater.hpp"
 #include <stdio.h>
 
 using namespace nall;
 
-Updater::Updater()
+Updater::Updater() : libretro_current(libretro_rows)
 {
    // After an update, killit! :D
    delete_old_exe();
@@ -21,6 +25,18 @@ Updater::Updater()
    timer.setInterval(50);
    timer.setEnabled(false);
 
+   queue.cancelled = false;
+   for (unsigned i = 0; i < max_workers; i++)
+      queue.running[i] = queue.exited[i] = false;
+   queue.received = queue.last_received = 0;
+   queue.last_time = 0;
+   queue.rate = 0.0;
+
+   extraction.job = 0;
+   extraction.done = extraction.total = 0;
+   extraction.finished = false;
+   extraction.result = false;
+
    version_download.setText("Check version");
    dl_layout.append(version_download, 0, 0);
    download.setText("Download RetroArch");
@@ -32,7 +48,7 @@ Updater::Updater()
    progress.setPosition(0);
    progress_layout.append(progress, 300, 0, 10);
    progress_label.setText("N/A");
-   progress_layout.append(progress_label, 100, 0, 3);
+   progress_layout.append(progress_label, 200, 0, 3);
    vbox.append(progress_layout);
 
    opts_32bit.setText("x86");
@@ -69,6 +85,7 @@ Updater::Updater()
    vbox.append(current_label, ~0, 0, 20);
 
    libretro_download.setText("Download core");
+   libretro_update_all.setText("Update downloaded cores");
    libretro_use.setText("Use core");
    libretro_download.onTick = [this] {
       if (!libretro_listview.selected())
@@ -80,6 +97,16 @@ Updater::Updater()
       initiate_download();
    };
 
+   // Refreshes every core already on disk in one go, without asking about each.
+   libretro_update_all.onTick = [this] {
+      foreach (elem, libretro_current)
+      {
+         if (elem->downloaded)
+            enqueue(download_job::kind::core, {elem->basename, ".zip"},
+                  {basedir(), elem->basename, ".dll"}, false, true);
+      }
+   };
+
    libretro_use.onTick = [this] {
       if (!libretro_listview.selected())
       {
@@ -87,7 +114,7 @@ Updater::Updater()
          return;
       }
 
-      const auto &elem = libretro_current[libretro_listview.selection()];
+      const auto &elem = *libretro_current[libretro_listview.selection()];
       string path = {basedir(), elem.basename, ".dll"};
       if (!nall::file::exists(path))
       {
@@ -104,6 +131,7 @@ Updater::Updater()
    };
 
    libretro_buttons.append(libretro_download, 0, 0);
+   libretro_buttons.append(libretro_update_all, 0, 0);
    libretro_buttons.append(libretro_use, 0, 0);
    vbox.append(libretro_buttons, 5);
 
@@ -118,16 +146,10 @@ Updater::Updater()
    setGeometry({128, 128, minimum.width, minimum.height});
 
    version_download.onTick = [this] {
-      transfer.version_only = true;
-      transfer.libretro = false;
-      start_download(latest_file());
+      enqueue(download_job::kind::list, latest_file());
    };
 
    download.onTick = [this] {
-
-      transfer.version_only = false;
-      transfer.libretro = false;
-      
       nall::string path;
       path.append(opts_redist.checked() ? "RetroArch-win" : "retroarch-win");
       path.append(opts_32bit.checked() ? "32-" : "64-");
@@ -139,14 +161,13 @@ Updater::Updater()
          path.append(opts_slim.checked() ? "slim.zip" : "full.zip");
       }
 
-      start_download(path);
+      enqueue(download_job::kind::retroarch, path);
    };
 
    libretro_listview.onActivate = {&Updater::initiate_download, this};
 
    cancel_download.onTick = [this] {
-      nall::scoped_lock lock(transfer.lock);
-      transfer.cancelled = true;
+      queue.cancelled = true;
    };
 
    opts_32bit.onTick = {&Updater::update_listview, this};
@@ -160,11 +181,8 @@ Updater::Updater()
 
 void Updater::initiate_download()
 {
-   transfer.version_only = false;
-   transfer.libretro = true;
-
-   const auto &elem = libretro_current[libretro_listview.selection()];
-   transfer.libretro_path = {basedir(), elem.basename, ".dll"};
+   const auto &elem = *libretro_current[libretro_listview.selection()];
+   nall::string libretro_path = {basedir(), elem.basename, ".dll"};
 
    if (elem.downloaded)
    {
@@ -175,7 +193,7 @@ void Updater::initiate_download()
       if (response == MessageWindow::Response::Yes)
       {
          if (response == MessageWindow::Response::Yes && libretro_path_cb)
-            libretro_path_cb(transfer.libretro_path);
+            libretro_path_cb(libretro_path);
       }
       else
       {
@@ -184,38 +202,97 @@ void Updater::initiate_download()
                MessageWindow::Buttons::YesNo);
 
          if (response == MessageWindow::Response::Yes)
-            start_download({elem.basename, ".zip"});
+            enqueue(download_job::kind::core, {elem.basename, ".zip"}, libretro_path, true, true);
       }
    }
    else
-      start_download({elem.basename, ".zip"});
+      enqueue(download_job::kind::core, {elem.basename, ".zip"}, libretro_path);
 }
 
-void Updater::start_download(const string &path)
+void Updater::enqueue(download_job::kind type, const nall::string &path,
+      const nall::string &libretro_path, bool prompt, bool delta)
 {
-   transfer.finished = false;
-   transfer.success = false;
-   transfer.cancelled = false;
-   transfer.now = 0;
-   transfer.total = 0;
-   transfer.data.clear();
+   nall::scoped_lock lock(queue.lock);
 
-   progress.setPosition(0);
-   disable_downloads();
-   cancel_download.setEnabled(true);
+   // A file which is already queued is only fetched once.
+   foreach (item, queue.list)
+   {
+      if (item->path == path)
+         return;
+   }
 
-   transfer.file_path = path;
-   transfer.thread = nall::thread(&Updater::download_thread, this, path);
+   if (queue.list.size() == 0)
+   {
+      queue.cancelled = false;
+      queue.received = queue.last_received = 0;
+      queue.last_time = GetTickCount();
+      queue.rate = 0.0;
+      progress.setPosition(0);
+   }
 
+   download_job *job = new download_job;
+   job->type = type;
+   job->path = path;
+   job->libretro_path = libretro_path;
+   job->prompt = prompt;
+   job->delta = delta;
+   job->patched = false;
+   job->part_path = {basedir(), path, ".part"};
+   job->fd = -1;
+   job->size = 0;
+   job->has_digest = false;
+   job->state = download_job::status::queued;
+   job->now = 0;
+   job->total = 0;
+   job->attempts = 0;
+   job->retry_time = 0;
+   queue.list.append(job);
+   update_row(job);
+   lock.unlock();
+
+   spawn_workers();
+   cancel_download.setEnabled(true);
    timer.setEnabled(true);
 }
 
+void Updater::spawn_workers()
+{
+   nall::scoped_lock lock(queue.lock);
+
+   // Workers which ran out of jobs are joined before their slot is reused.
+   // They never touch the queue again after flagging themselves as exited.
+   for (unsigned i = 0; i < max_workers; i++)
+   {
+      if (queue.running[i] && queue.exited[i])
+      {
+         queue.threads[i].join();
+         queue.running[i] = false;
+      }
+   }
+
+   unsigned queued = 0;
+   foreach (job, queue.list)
+   {
+      if (job->state == download_job::status::queued)
+         queued++;
+   }
+
+   for (unsigned i = 0; i < max_workers && queued; i++, queued--)
+   {
+      if (queue.running[i])
+         continue;
+
+      queue.running[i] = true;
+      queue.exited[i] = false;
+      queue.threads[i] = nall::thread(&Updater::download_worker, this, i);
+   }
+}
+
 void Updater::cancel()
 {
    hide();
    progress_label.setText("N/A");
-   nall::scoped_lock lock(transfer.lock);
-   transfer.cancelled = true;
+   queue.cancelled = true;
 }
 
 void Updater::show()
@@ -247,98 +324,144 @@ void Updater::delete_old_exe()
    DeleteFile(backup_path);
 }
 
-bool Updater::extract_zip(const nall::string &path)
+// Opens the archive and starts extracting it. Entries are written to temporary files,
+// which end_extraction() only moves over the old files if all of them passed their CRC check.
+bool Updater::begin_extraction(download_job *job)
 {
-   nall::zip z;
-   if (!z.open({basedir(), path}))
+   if (!extraction.z.open({basedir(), job->path}))
    {
       MessageWindow::critical(*this, "Failed opening ZIP!");
       return false;
    }
 
-   foreach (file, z.file)
+   extraction.entries.reset();
+   for (unsigned i = 0; i < extraction.z.file.size(); i++)
    {
+      const nall::string &name = extraction.z.file[i].name;
+
       // Don't overwrite config files.
-      if (file.name.endswith(".cfg") && nall::file::exists({basedir(), file.name}))
+      if (name.endswith(".cfg") && nall::file::exists({basedir(), name}))
          continue;
-
-      uint8_t *data;
-      unsigned size;
-      if (!z.extract(file, data, size))
+      if (name.endswith("/"))
          continue;
 
-      if (file.name == "retroarch-phoenix.exe") // Oh snap, we have to do magic trickery! :D
-         move_self_exe();
+      extraction.entries.append({i, nall::string(basedir(), name, ".tmp"), false});
+   }
+
+   extraction.job = job;
+   extraction.done = extraction.total = 0;
+   extraction.finished = false;
+
+   // Nothing new can be queued until the archive has been replaced.
+   disable_downloads();
+   extraction.thread = nall::thread(&Updater::extraction_worker, this);
+   return true;
+}
+
+void Updater::extraction_worker()
+{
+   extraction.result = extraction.z.extract(extraction.entries, 0, [this](uint64_t done, uint64_t total) {
+      extraction.done = done;
+      extraction.total = total;
+   });
+   extraction.finished = true;
+}
+
+// Called from the timer once the worker is done. If any entry failed, nothing is
+// replaced and the archive is kept.
+void Updater::end_extraction()
+{
+   extraction.thread.join();
+   download_job *job = extraction.job;
+   extraction.job = 0;
 
-      if (!nall::file::write({basedir(), file.name}, data, size))
+   foreach (entry, extraction.entries)
+   {
+      if (!extraction.result)
       {
-         delete [] data;
+         DeleteFile(entry.filename);
          continue;
       }
 
-      delete [] data;
+      const nall::string &name = extraction.z.file[entry.index].name;
+      if (name == "retroarch-phoenix.exe") // Oh snap, we have to do magic trickery! :D
+         move_self_exe();
+
+      MoveFileEx(entry.filename, nall::string(basedir(), name), MOVEFILE_REPLACE_EXISTING);
    }
 
-   z.close();
+   extraction.z.close();
+   enable_downloads();
 
-   nall::string rmpath(basedir(), path);
+   if (extraction.result)
+   {
+      nall::string rmpath(basedir(), job->path);
 #ifdef _WIN32
-   DeleteFile(rmpath);
+      DeleteFile(rmpath);
 #else
-   ::unlink(rmpath);
+      ::unlink(rmpath);
 #endif
+      end_install(job);
+   }
+   else
+      MessageWindow::critical(*this, {"Failed extracting ", job->path, "! The archive was kept."});
 
-   return true;
+   delete job;
 }
 
-Updater::libretro_desc Updater::line2desc(const nall::string &line)
+// Fields are trimmed as views, so only the five that are kept get copied.
+Updater::libretro_desc Updater::line2desc(const nall::string_view &line)
 {
-   nall::lstring list;
-   list.split(",", line);
+   nall::string_view fields[5];
+   unsigned count = 0;
+   for (auto field : nall::split_view(line, ","))
+   {
+      if (count == 5)
+         break;
+      fields[count++] = field.trim(" ", " ");
+   }
 
    static const nall::string na = "<Invalid>";
-   if (list.size() < 5)
+   if (count < 5)
       return {na, na, na, na, na};
 
    return { // This is starting to look like JavaScript ... :D
-      list[0].trim(" ", " "),
-      list[1].trim(" ", " "),
-      list[2].trim(" ", " "),
-      list[3].trim(" ", " "),
-      list[4].trim(" ", " "),
+      fields[0],
+      fields[1],
+      fields[2],
+      fields[3],
+      fields[4],
    };
 }
 
-void Updater::end_transfer_list()
+void Updater::end_transfer_list(download_job *job)
 {
-   if (transfer.data.size() == 0)
-      return;
-
-   transfer.data.push_back('\0');
-
-   nall::lstring list;
-   list.split("\n", transfer.data.data());
-   if (list.size() == 0)
+   uint8_t *data;
+   unsigned size;
+   bool valid = nall::file::read(job->part_path, data, size);
+   DeleteFile(job->part_path);
+   if (!valid)
       return;
 
-   transfer.version = list[0];
-   list.remove(0);
-   transfer.redist_version = strtoul(list[0], 0, 0);
-   list.remove(0);
+   // The listing is parsed in place: the version, the redist version, then one core per line.
+   unsigned index = 0;
+   for (auto line : nall::split_view({(const char*)data, size}, "\n"))
+   {
+      if (index == 0)
+         transfer.version = line;
+      else if (index == 1)
+         transfer.redist_version = strtoul(nall::string(line), 0, 0);
+      else if (!line.empty())
+         libretro_list.append(line2desc(line));
+      index++;
+   }
+   delete [] data;
 
    string latest("Latest release: ", transfer.version);
    latest_label.setText({"Latest release: ", transfer.version});
 
    version_download.setEnabled(false);
-
-   foreach (elem_, list)
-   {
-      if (elem_.length() > 0)
-      {
-         const auto &elem = line2desc(elem_);
-         libretro_list.append(elem);
-      }
-   }
+   enable_downloads();
 
    update_listview();
 
@@ -351,19 +474,21 @@ void Updater::update_listview()
 {
    libretro_listview.reset();
    libretro_current.reset();
+   libretro_rows.reset();
 
    bool x86 = opts_32bit.checked();
    foreach (elem, libretro_list)
    {
       if (opts_32bit.checked() && elem.arch == "x86")
-         libretro_current.append(elem);
+         libretro_current.append(&elem);
       else if (opts_64bit.checked() && elem.arch == "x86_64")
-         libretro_current.append(elem);
+         libretro_current.append(&elem);
    }
 
    auto dir = basedir();
-   foreach (elem, libretro_current)
+   foreach (row, libretro_current)
    {
+      auto &elem = *row;
       elem.downloaded = nall::file::exists({dir, elem.basename, ".dll"});
       libretro_listview.append(elem.system, elem.core, elem.version, elem.arch, nall::string(elem.basename, ".dll"), nall::string(elem.downloaded ? "Yes" : "No"));
    }
@@ -371,114 +496,173 @@ void Updater::update_listview()
    libretro_listview.autoSizeColumns();
 }
 
-bool Updater::end_file_transfer()
+// Puts the downloaded file in place: the patched core, or the archive to extract.
+bool Updater::end_file_transfer(download_job *job)
 {
-   bool valid = false;
-   if (nall::file::write({basedir(), transfer.file_path},
-            (const uint8_t *)transfer.data.data(),
-            transfer.data.size()))
+   if (job->patched)
    {
-      valid = true;
+      // The worker already wrote the patched core and verified its checksum.
+      DeleteFile(job->part_path);
+      if (MoveFileEx(nall::string(job->libretro_path, ".tmp"), job->libretro_path, MOVEFILE_REPLACE_EXISTING))
+         return true;
+
+      MessageWindow::critical(*this, "Failed replacing core!");
+      return false;
    }
-   else
-      MessageWindow::critical(*this, "Failed saving archive to disk!");
 
-   if (valid && extract_zip(transfer.file_path))
+   if (MoveFileEx(job->part_path, nall::string(basedir(), job->path), MOVEFILE_REPLACE_EXISTING))
+      return true;
+
+   MessageWindow::critical(*this, "Failed saving archive to disk!");
+   return false;
+}
+
+void Updater::timer_event()
+{
+   nall::linear_vector<download_job*> done;
    {
-      if (transfer.libretro)
+      nall::scoped_lock lock(queue.lock);
+      for (unsigned i = 0; i < queue.list.size(); )
       {
-         auto response = MessageWindow::information(*this,
-               {"Extracted core to ", transfer.libretro_path,
-               ".\nDo you want to use this core?"}, MessageWindow::Buttons::YesNo);
+         download_job *job = queue.list[i];
+         if (job->state == download_job::status::finished ||
+               job->state == download_job::status::failed)
+         {
+            done.append(job);
+            queue.list.remove(i);
+         }
+         else
+            i++;
+      }
+   }
 
-         if (response == MessageWindow::Response::Yes && libretro_path_cb)
-            libretro_path_cb(transfer.libretro_path);
+   spawn_workers();
 
-         update_listview();
+   bool extracted = extraction.job && extraction.finished;
+   if (done.size() || extracted || (!extraction.job && extraction.pending.size()))
+   {
+      // Message boxes run their own event loop, so don't get called again meanwhile.
+      timer.setEnabled(false);
+      for (unsigned i = 0; i < done.size(); i++)
+      {
+         if (end_download(done[i]))
+            delete done[i];
       }
-      else
+
+      if (extracted)
+         end_extraction();
+
+      while (!extraction.job && extraction.pending.size())
       {
-         MessageWindow::information(*this, "Extracted archive!");
-         update_retroarch_version();
+         download_job *job = extraction.pending[0];
+         extraction.pending.remove(0);
+         if (!begin_extraction(job))
+            delete job;
       }
+      timer.setEnabled(true);
    }
-   else if (valid)
+
+   update_progress();
+
+   if (extraction.job)
    {
-      MessageWindow::critical(*this, "Failed opening ZIP!");
-      return false;
+      uint64_t now = extraction.done, total = extraction.total;
+      if (total)
+         progress.setPosition(now * 100 / total);
+      progress_label.setText({"Extracting: ", (unsigned)(now / 1000000), " / ", (unsigned)(total / 1000000), " MB"});
    }
 
-   return true;
+   nall::scoped_lock lock(queue.lock);
+   if (queue.list.size() == 0)
+   {
+      // Keep ticking until the extraction is done.
+      if (!extraction.job)
+         timer.setEnabled(false);
+      cancel_download.setEnabled(false);
+      queue.cancelled = false;
+   }
 }
 
-void Updater::timer_event()
+// Returns false if the job was handed on for extraction, which frees it once done.
+bool Updater::end_download(download_job *job)
 {
-   nall::scoped_lock lock(transfer.lock);
+   if (job->state != download_job::status::finished)
+   {
+      if (!queue.cancelled)
+         MessageWindow::warning(*this, {"Download of ", job->path, " was not completed!"});
+      update_row(job);
+
+      if (job->fd >= 0)
+         ::close(job->fd);
+      DeleteFile(job->part_path);
+      return true;
+   }
 
-   if (transfer.finished)
+   progress.setPosition(100);
+
+   if (job->type == download_job::kind::list)
    {
-      timer.setEnabled(false);
-      if (transfer.success)
-      {
-         progress.setPosition(100);
+      end_transfer_list(job);
+      return true;
+   }
 
-         if (transfer.version_only)
-            end_transfer_list();
-         else
-         {
-            bool success = end_file_transfer();
+   if (!end_file_transfer(job))
+      return true;
 
-            if (success)
-            {
-               if (opts_full.checked() && (current_redist_version() != transfer.redist_version))
-               {
-                  auto response = MessageWindow::information(*this,
-                        {"You downloaded full build, but redist is outdated.\n",
-                        "Current: ", current_redist_version(), "\n",
-                        "Available: ", transfer.redist_version, "\n",
-                        "Do you want to download it now?"},
-                        MessageWindow::Buttons::YesNo);
-
-                  if (response == MessageWindow::Response::Yes)
-                  {
-                     transfer.libretro = false;
-                     transfer.version_only = false;
-                     nall::string arch(opts_32bit.checked() ? "32-" : "64-");
-                     start_download({"RetroArch-win", arch, "libs.zip"});
-                     return;
-                  }
-               }
-
-               if (!transfer.libretro && !opts_redist.checked())
-               {
-                  MessageWindow::information(*this,
-                        "RetroArch-Phoenix is updated. Restart the program to complete the update.");
-               }
-            }
-         }
-      }
-      else
-         MessageWindow::warning(*this, "Download was not completed!");
+   if (job->patched)
+   {
+      end_install(job);
+      return true;
+   }
 
-      cancel_download.setEnabled(false);
+   extraction.pending.append(job);
+   return false;
+}
 
-      if (transfer.version.length() > 0)
-         enable_downloads();
+// Tells the user about a core or RetroArch build that was put in place.
+void Updater::end_install(download_job *job)
+{
+   if (job->type == download_job::kind::core)
+   {
+      if (job->prompt)
+      {
+         auto response = MessageWindow::information(*this,
+               {job->patched ? "Patched core " : "Extracted core to ", job->libretro_path,
+               ".\nDo you want to use this core?"}, MessageWindow::Buttons::YesNo);
 
-      lock.unlock();
-      transfer.thread.join();
+         if (response == MessageWindow::Response::Yes && libretro_path_cb)
+            libretro_path_cb(job->libretro_path);
+      }
+
+      update_listview();
+      return;
    }
-   else if (transfer.cancelled)
+
+   MessageWindow::information(*this, "Extracted archive!");
+   update_retroarch_version();
+
+   if (opts_full.checked() && (current_redist_version() != transfer.redist_version))
    {
-      timer.setEnabled(false);
-      enable_downloads();
-      cancel_download.setEnabled(false);
+      auto response = MessageWindow::information(*this,
+            {"You downloaded full build, but redist is outdated.\n",
+            "Current: ", current_redist_version(), "\n",
+            "Available: ", transfer.redist_version, "\n",
+            "Do you want to download it now?"},
+            MessageWindow::Buttons::YesNo);
 
-      lock.unlock();
-      transfer.thread.join();
+      if (response == MessageWindow::Response::Yes)
+      {
+         nall::string arch(opts_32bit.checked() ? "32-" : "64-");
+         enqueue(download_job::kind::retroarch, {"RetroArch-win", arch, "libs.zip"});
+         return;
+      }
    }
 
-   update_progress();
+   if (!opts_redist.checked())
+   {
+      MessageWindow::information(*this,
+            "RetroArch-Phoenix is updated. Restart the program to complete the update.");
+   }
 }
 
 unsigned Updater::current_redist_version()
@@ -497,61 +681,386 @@ unsigned Updater::current_redist_version()
       return 0;
 }
 
+static nall::string size_text(uint64_t size)
+{
+   if (size > 1000000)
+      return {nall::fp(size / 1000000.0, 3), " MB"};
+   else if (size > 1000)
+      return {nall::fp(size / 1000.0, 3), " kB"};
+   else
+      return {(unsigned)size, " B"};
+}
+
 void Updater::update_progress()
 {
-   string text;
-   if (transfer.now > 1000000)
+   // No locking needed, the UI is the only one changing the list and the rest is atomic.
+   uint64_t now = 0, total = 0;
+   unsigned active = 0, queued = 0;
+   foreach (job, queue.list)
    {
-      text.append(nall::fp(transfer.now / 1000000.0, 3));
-      text.append(" MB");
+      if (job->state == download_job::status::active)
+         active++;
+      else if (job->state == download_job::status::queued)
+         queued++;
+
+      now += job->now;
+      total += job->total ? job->total : job->now;
+      update_row(job);
    }
-   else if (transfer.now > 1000)
+
+   // Throughput is averaged over a second, the timer ticks too often for anything smoother.
+   unsigned time = GetTickCount();
+   if (time - queue.last_time >= 1000)
    {
-      text.append(nall::fp(transfer.now / 1000.0, 3));
-      text.append(" kB");
+      queue.rate = (queue.received - queue.last_received) * 1000.0 / (time - queue.last_time);
+      queue.last_received = queue.received;
+      queue.last_time = time;
    }
-   else
-      text.append(transfer.now, " B");
 
-   if (transfer.total)
-      progress.setPosition(transfer.now * 100 / transfer.total);
+   if (queue.list.size() == 0)
+      return;
+
+   if (total)
+      progress.setPosition(now * 100 / total);
 
+   nall::string text = {size_text(now), ", ", size_text(queue.rate), "/s"};
+   if (active + queued > 1)
+      text.append(" (", active, " active, ", queued, " queued)");
    progress_label.setText(text);
 }
 
-void Updater::download_thread(const nall::string &path)
+// Shows the progress of a core download in the listview.
+void Updater::update_row(const download_job *job)
+{
+   if (job->type != download_job::kind::core)
+      return;
+
+   for (unsigned i = 0; i < libretro_current.size(); i++)
+   {
+      const auto &elem = *libretro_current[i];
+      if (job->path != nall::string(elem.basename, ".zip"))
+         continue;
+
+      nall::string state;
+      if (job->state == download_job::status::queued)
+         state = job->attempts ? "Retrying" : "Queued";
+      else if (job->state == download_job::status::active && job->total)
+         state = {(unsigned)((uint64_t)job->now * 100 / job->total), "%"};
+      else if (job->state == download_job::status::active)
+         state = size_text(job->now);
+      else
+         state = elem.downloaded ? "Yes" : "No";
+
+      libretro_listview.modify(i, elem.system, elem.core, elem.version, elem.arch,
+            nall::string(elem.basename, ".dll"), state);
+      return;
+   }
+}
+
+void Updater::download_worker(unsigned index)
 {
    nall::http dl;
-   dl.write_cb = {&Updater::update, this};
-   dl.progress_cb = {&Updater::progress_update, this};
+   bool connected = false;
+   nall::ring<uint8_t> buffer(write_buffer);
+
+   for (;;)
+   {
+      download_job *job = 0;
+      bool pending = false;
+
+      {
+         nall::scoped_lock lock(queue.lock);
+         unsigned time = GetTickCount();
+         foreach (item, queue.list)
+         {
+            if (item->state != download_job::status::queued)
+               continue;
+
+            if (queue.cancelled)
+               item->state = download_job::status::failed;
+            else if (item->attempts && (int)(item->retry_time - time) > 0)
+               pending = true;
+            else if (!job)
+               job = item;
+         }
+
+         if (job)
+            job->state = download_job::status::active;
+         else if (!pending)
+         {
+            queue.exited[index] = true;
+            break;
+         }
+      }
+
+      // Only retries still backing off are left.
+      if (!job)
+      {
+         Sleep(50);
+         continue;
+      }
+
+      // The connection is reused for the next download, until the server drops it.
+      auto connect = [&]() {
+         if (!connected || !dl.keepalive)
+         {
+            dl.disconnect();
+            connected = dl.connect(base_host());
+         }
+         return connected;
+      };
+
+      // The server may have closed a kept-alive connection while it sat idle.
+      // A request that fails on a reused connection before any response arrived
+      // is sent again at once on a fresh one, without counting as an attempt.
+      auto attempt = [&](const nall::function<bool ()> &request) {
+         bool reused = connected && dl.keepalive;
+         if (!connect())
+            return false;
+         if (request())
+            return true;
+         if (!reused || dl.status != 0)
+            return false;
+         connected = false;
+         return connect() && request();
+      };
+
+      // Anything going wrong with a delta falls back to the full archive at once.
+      if (job->delta)
+      {
+         job->delta = false;
+         job->patched = attempt([&] { return fetch_delta(dl, job, buffer); });
+      }
+
+      bool ret = job->patched || attempt([&] { return fetch(dl, job, job->path, buffer); });
+
+      // Client errors won't go away by asking again.
+      bool retry = dl.status < 400 || dl.status >= 500 || dl.status == 416;
+
+      if (ret && job->fd >= 0)
+      {
+         ret = ::close(job->fd) == 0;
+         job->fd = -1;
+      }
 
-   bool ret;
-   if ((ret = dl.connect(base_host())))
+      nall::scoped_lock lock(queue.lock);
+      if (ret)
+         job->state = download_job::status::finished;
+      else if (retry && !queue.cancelled && ++job->attempts < max_attempts)
+      {
+         // Back off exponentially, starting at one second.
+         job->state = download_job::status::queued;
+         job->retry_time = GetTickCount() + (500u << job->attempts);
+      }
+      else
+         job->state = download_job::status::failed;
+   }
+
+   dl.disconnect();
+}
+
+// Hotfixes usually change little of a core, so the server may offer UPS patches
+// from older builds, named after the CRC32 of the build they apply to. The patch
+// is streamed onto the installed core here, off the UI thread, and only kept if
+// the patched core matches the target checksum recorded in the patch.
+bool Updater::fetch_delta(nall::http &dl, download_job *job, nall::ring<uint8_t> &buffer)
+{
+   nall::filemap source;
+   if (!source.open(job->libretro_path, nall::filemap::mode::read))
+      return false;
+
+   uint32_t crc32 = nall::crc32_calculate(source.data(), source.size());
+   nall::string basename = job->path;
+   basename.rtrim<1>(".zip");
+   nall::string path = {basename, "-", nall::hex<8>(crc32), ".ups"};
+
+   bool ret = fetch(dl, job, path, buffer);
+   if (job->fd >= 0)
+      ret = ::close(job->fd) == 0 && ret;
+   job->fd = -1;
+
+   nall::filemap patch;
+   if (ret && patch.open(job->part_path, nall::filemap::mode::read))
    {
-      ret = dl.download({base_folder(), path});
-      dl.disconnect();
+      nall::string target_path = {job->libretro_path, ".tmp"};
+      int fd = nall::file::create(target_path);
+
+      nall::ups ups;
+      ret = fd >= 0 && ups.apply(patch.data(), patch.size(), source.data(), source.size(), fd) == nall::ups::result::success;
+      ret = fd >= 0 && ::close(fd) == 0 && ret;
+      patch.close();
+
+      if (!ret)
+         DeleteFile(target_path);
    }
+   else
+      ret = false;
+
+   // The full archive is downloaded into the same file.
+   if (!ret)
+      restart(job);
 
-   nall::scoped_lock lock(transfer.lock);
-   transfer.success = ret;
-   transfer.finished = true;
+   return ret;
 }
 
-void Updater::update(const char *content, unsigned size)
+// Starts a download over, with an empty file.
+bool Updater::restart(download_job *job)
 {
-   nall::scoped_lock lock(transfer.lock);
-   transfer.data.insert(transfer.data.end(), content, content + size);
-   transfer.now = transfer.data.size();
+   if (job->fd >= 0)
+      ::close(job->fd);
+
+   job->fd = nall::file::create(job->part_path);
+   job->size = 0;
+   job->has_digest = false;
+   job->crc32 = ~0;
+   nall::sha256_init(&job->sha256);
+   return job->fd >= 0;
 }
 
-bool Updater::progress_update(unsigned now, unsigned total)
+bool Updater::fetch(nall::http &dl, download_job *job, const nall::string &path, nall::ring<uint8_t> &buffer)
 {
-   nall::scoped_lock lock(transfer.lock);
+   dl.status = 0;
+   if (job->fd < 0 && !restart(job))
+      return false;
+
+   // A retry resumes where the previous attempt stopped.
+   uint64_t offset = job->size;
+   nall::string range;
+   if (offset)
+      range = {"Range: bytes=", (unsigned)offset, "-\r\n"};
+
+   // Received data is handed through a fixed ring buffer to a writer thread,
+   // which hashes it and writes it out. Memory use doesn't depend on the size
+   // of the file, and the network side only waits when the disk falls behind.
+   std::atomic<bool> done(false), written(true);
+   nall::event readable, writable;
+   nall::thread writer([&] {
+      for (;;)
+      {
+         const uint8_t *data;
+         unsigned length = buffer.peek(data);
+         if (!length)
+         {
+            if (!done)
+            {
+               readable.wait();
+               continue;
+            }
+
+            // Anything committed before done was set is visible now.
+            if (!(length = buffer.peek(data)))
+               break;
+         }
+
+         // After a failed write, data is still drained so the network side can finish.
+         if (written)
+         {
+            job->crc32 = nall::crc32_update(job->crc32, data, length);
+            nall::sha256_chunk(&job->sha256, data, length);
+            written = nall::file::write(job->fd, data, length);
+            job->size += length;
+         }
+
+         buffer.consume(length);
+         writable.signal();
+      }
+   });
+
+   bool first = true, mismatch = false;
+   dl.write_cb = [&](const char *content, unsigned size) {
+      if (first)
+      {
+         // The server may ignore the range and send everything again.
+         // Nothing has been handed to the writer yet.
+         first = false;
+         if (dl.status != 206)
+            written = offset == 0 || restart(job);
+         else if (!dl.field("Content-Range").beginswith(nall::string("bytes ", (unsigned)offset, "-")))
+            mismatch = true;
+      }
+
+      while (size && !mismatch && written)
+      {
+         uint8_t *data;
+         unsigned length = buffer.reserve(data);
+         if (!length)
+         {
+            writable.wait();
+            continue;
+         }
+
+         length = nall::min(length, size);
+         memcpy(data, content, length);
+         buffer.commit(length);
+         readable.signal();
+
+         content += length;
+         size -= length;
+      }
+   };
+
+   unsigned last = 0;
+   dl.progress_cb = [&](unsigned now, unsigned total) {
+      unsigned base = dl.status == 206 ? offset : 0;
+
+      queue.received += now - last;
+      last = now;
+
+      job->now = base + now;
+      job->total = total ? base + total : 0;
+      return !queue.cancelled && !mismatch && written;
+   };
+
+   bool ret = dl.request({base_folder(), path}, range) && dl.response();
 
-   transfer.now = now;
-   transfer.total = total;
+   done = true;
+   readable.signal();
+   writer.join();
+
+   // RFC 3230 instance digests cover the whole file, even for partial responses.
+   nall::lstring digest;
+   digest.split(",", dl.field("Digest"));
+   foreach (elem, digest)
+   {
+      elem.trim(" ", " ");
+      if (!elem.ibeginswith("SHA-256="))
+         continue;
+
+      // nall::base64 uses the URL-safe alphabet.
+      nall::string value(elem() + 8);
+      value.transform("+/", "-_");
+
+      uint8_t *data;
+      unsigned length;
+      if (nall::base64::decode(data, length, value) && length >= 32)
+      {
+         memcpy(job->digest, data, 32);
+         job->has_digest = true;
+      }
+      delete [] data;
+   }
+
+   // What we have is no good to resume from.
+   if (mismatch || dl.status == 416)
+      restart(job);
+
+   if (ret && written && !mismatch && job->has_digest)
+   {
+      nall::sha256_ctx sha256 = job->sha256;
+      uint8_t hash[32];
+      nall::sha256_final(&sha256);
+      nall::sha256_hash(&sha256, hash);
+
+      if (memcmp(hash, job->digest, 32))
+      {
+         restart(job);
+         ret = false;
+      }
+   }
 
-   return !transfer.cancelled;
+   dl.write_cb = nall::function<void (const char *, unsigned)>();
+   dl.progress_cb = nall::function<bool (unsigned, unsigned)>();
+   return ret && written && !mismatch;
 }
 
 nall::string Updater::basedir()
@@ -575,6 +1084,7 @@ void Updater::enable_downloads()
    download.setEnabled(true);
    libretro_listview.setEnabled(true);
    libretro_download.setEnabled(true);
+   libretro_update_all.setEnabled(true);
    libretro_use.setEnabled(true);
 }
 
@@ -583,6 +1093,7 @@ void Updater::disable_downloads()
    download.setEnabled(false);
    libretro_listview.setEnabled(false);
    libretro_download.setEnabled(false);
+   libretro_update_all.setEnabled(false);
    libretro_use.setEnabled(false);
 }
 
@@ -3,8 +3,14 @@
 
 #include <phoenix.hpp>
 #include <vector>
+#include <atomic>
 #include <nall/thread.hpp>
+#include <nall/arena.hpp>
 #include <nall/function.hpp>
+#include <nall/http.hpp>
+#include <nall/sha256.hpp>
+#include <nall/ring.hpp>
+#include <nall/zip.hpp>
 
 using namespace phoenix;
 
@@ -17,9 +23,6 @@ class Updater : public Window
       void hide();
       void cancel();
 
-      void update(const char *content, unsigned size);
-      bool progress_update(unsigned now, unsigned total);
-
       nall::function<void (const nall::string &path)> libretro_path_cb;
       nall::function<nall::string()> retroarch_path_cb;
 
@@ -27,34 +30,96 @@ class Updater : public Window
       Timer timer;
       void timer_event();
 
-      void start_download(const nall::string &path);
-      void download_thread(const nall::string &path);
+      // A file to fetch from the server. Downloads are queued and handed out to
+      // a pool of worker threads, each keeping its own connection alive.
+      struct download_job
+      {
+         enum class kind : unsigned { list, retroarch, core };
+         enum class status : unsigned { queued, active, finished, failed };
+
+         kind type;
+         nall::string path;
+         nall::string libretro_path;
+         bool prompt; // Ask whether to use a core once it is extracted.
+         bool delta; // Try a UPS patch against the installed core first.
+         bool patched; // The core was updated by a patch, not from the archive.
+
+         // Data is streamed to a temporary file next to the target, and hashed as
+         // it is written. Only touched by the worker while active, and by the UI
+         // once finished.
+         nall::string part_path;
+         int fd;
+         uint64_t size;
+         uint32_t crc32;
+         nall::sha256_ctx sha256;
+         uint8_t digest[32]; // Announced by the server, if has_digest.
+         bool has_digest;
+
+         // Progress is read by the UI without locking. The state only changes
+         // under queue.lock, so that two workers never pick the same job.
+         std::atomic<status> state;
+         std::atomic<unsigned> now, total;
+         unsigned attempts;
+         unsigned retry_time;
+      };
+
+      enum : unsigned { max_workers = 4, max_attempts = 5, write_buffer = 256 * 1024 };
+
+      struct
+      {
+         // Only the UI adds and removes jobs, and it does so under the lock.
+         nall::linear_vector<download_job*> list;
+         nall::mutex lock;
+         std::atomic<bool> cancelled;
+
+         nall::thread threads[max_workers];
+         bool running[max_workers]; // Thread started, not joined yet.
+         bool exited[max_workers]; // Thread done picking up jobs.
+
+         std::atomic<uint64_t> received; // Bytes received, for throughput.
+         uint64_t last_received;
+         unsigned last_time;
+         double rate;
+      } queue;
+
+      void enqueue(download_job::kind type, const nall::string &path,
+            const nall::string &libretro_path = "", bool prompt = true, bool delta = false);
+      void spawn_workers();
+      void download_worker(unsigned index);
+      bool fetch(nall::http &dl, download_job *job, const nall::string &path, nall::ring<uint8_t> &buffer);
+      bool fetch_delta(nall::http &dl, download_job *job, nall::ring<uint8_t> &buffer);
+      static bool restart(download_job *job);
+      bool end_download(download_job *job);
+      void end_install(download_job *job);
       void update_progress();
-      bool extract_zip(const nall::string &path);
+      void update_row(const download_job *job);
+
+      // Archives are extracted one at a time on their own thread, so the UI keeps
+      // running. The timer shows the progress, and replaces the old files once the
+      // worker is finished.
+      struct
+      {
+         nall::linear_vector<download_job*> pending;
+         download_job *job; // Being extracted, if any.
+         nall::zip z;
+         nall::linear_vector<nall::zip::job> entries;
+         nall::thread thread;
+         std::atomic<uint64_t> done, total;
+         std::atomic<bool> finished;
+         bool result;
+      } extraction;
+
+      bool begin_extraction(download_job *job);
+      void extraction_worker();
+      void end_extraction();
       void move_self_exe();
       void delete_old_exe();
       static unsigned current_redist_version();
       struct
       {
-         nall::thread thread;
-         bool finished;
-         bool success;
-         bool cancelled;
-         std::vector<char> data;
-         nall::mutex lock;
-
          nall::string version;
          nall::string retroarch_version;
          unsigned redist_version;
-
-         bool version_only;
-
-         nall::string file_path;
-
-         unsigned now, total;
-
-         bool libretro;
-         nall::string libretro_path;
       } transfer;
 
 #if 0
@@ -82,6 +147,7 @@ class Updater : public Window
 
       HorizontalLayout libretro_buttons;
       Button libretro_download;
+      Button libretro_update_all;
       Button libretro_use;
 
       ListView libretro_listview;
@@ -95,16 +161,18 @@ class Updater : public Window
          bool downloaded;
       };
       nall::linear_vector<libretro_desc> libretro_list;
-      nall::linear_vector<libretro_desc> libretro_current;
-      static libretro_desc line2desc(const nall::string &line);
+      // The rows shown for the selected architecture, rebuilt from libretro_list on each change.
+      nall::arena libretro_rows;
+      nall::linear_vector<libretro_desc*, nall::arena_allocator> libretro_current;
+      static libretro_desc line2desc(const nall::string_view &line);
       void update_listview();
       void update_retroarch_version();
 
       void initiate_download();
       void enable_downloads();
       void disable_downloads();
-      void end_transfer_list();
-      bool end_file_transfer();
+      void end_transfer_list(download_job *job);
+      bool end_file_transfer(download_job *job);
 
       VerticalLayout vbox;
 